@@ -72,4 +72,24 @@ void draw_fancy_image(uint32_t *image, uint32_t width, uint32_t height)
 	}
 }
 
+void draw_cursor_image(uint32_t *image, uint32_t width, uint32_t height)
+{
+	int size = (width < height ? width : height) * 3 / 4;
+	int x, y;
+
+	/* ARGB arrow, tip at (0, 0): white fill, black outline, transparent rest */
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			uint32_t v = 0x00000000;
 
+			if (y < size && x <= y / 2) {
+				if (x == 0 || x == y / 2 || y == size - 1)
+					v = 0xff000000;
+				else
+					v = 0xffffffff;
+			}
+
+			image[y * width + x] = v;
+		}
+	}
+}
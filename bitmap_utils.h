@@ -14,3 +14,4 @@
 void clear_image(uint32_t *dst, uint32_t width, uint32_t height);
 void draw_test_image(uint32_t *addr, uint32_t width, uint32_t height);
 void draw_fancy_image(uint32_t *image, uint32_t width, uint32_t height);
+void draw_cursor_image(uint32_t *image, uint32_t width, uint32_t height);
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <error.h>
 #include <errno.h>
+#include <time.h>
 
 #include <xf86drmMode.h>
 #include <xf86drm.h>
@@ -32,6 +33,7 @@ int main(int argc, char *argv[])
 	/* */
 
 	int ret, opt, imt = 0;
+	int moves = 0, step = 0;
 
 	/* drm vars */
 
@@ -69,10 +71,17 @@ int main(int argc, char *argv[])
 	char tx_buf[DRM_SRV_MSGLEN + 1];
 
 	uint32_t command;
+	int cx, cy;
+
+	/* presentation feedback */
+
+	struct timespec commit_ts;
+	uint32_t seq, sec, usec;
+	long latency;
 
 	/* parse command line */
 
-	while ((opt = getopt(argc, argv, "t:n:c:m:h")) != -1) {
+	while ((opt = getopt(argc, argv, "t:n:c:m:p:h")) != -1) {
 		switch (opt) {
 			case 'm':
 				mode_name = strdup(optarg);
@@ -86,6 +95,9 @@ int main(int argc, char *argv[])
 			case 't':
 				imt = atoi(optarg);
 				break;
+			case 'p':
+				moves = atoi(optarg);
+				break;
 			case 'h':
 			default:
 				printf("usage: -h] -c <connector> -e <encoder> -m <mode> -t <image type>\n");
@@ -94,6 +106,7 @@ int main(int argc, char *argv[])
 				printf("\t-c <crtc>			crtc id, default is 0\n");
 				printf("\t-m <mode>			mode name, default is 'preferred'\n");
 				printf("\t-t <image>		image type, default is 0\n");
+				printf("\t-p <moves>		move hardware cursor across the screen, default is 0\n");
 				exit(0);
 		}
 	}
@@ -248,7 +261,18 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
-			if (val != DRM_OK) {
+			if (val == DRM_PRESENTED) {
+				sscanf(rx_buf, "%d:%d:%u:%u:%u", &mag, &val, &seq, &sec, &usec);
+
+				latency = ((long) sec - commit_ts.tv_sec) * 1000000L +
+					(long) usec - commit_ts.tv_nsec / 1000;
+
+				fprintf(stdout, "presented at vblank %u: %u.%06u, latency %ld us\n",
+					seq, sec, usec, latency);
+				continue;
+			}
+
+			if (val != DRM_OK && val != DRM_COALESCED) {
 				fprintf(stdout, "got error from server, can't continue\n");
 				ret = -1;
 				break;
@@ -262,6 +286,7 @@ int main(int argc, char *argv[])
 					snprintf(tx_buf, sizeof(tx_buf), "%d:%d:%d:%d:%d:%s",
 						magic, command, crtc_id, conn_id, fb, mode->name);
 
+					clock_gettime(CLOCK_MONOTONIC, &commit_ts);
 					ret = write(sockfd, tx_buf, sizeof(tx_buf));
 					if (ret < 0) {
 						perror("could not send crtc message to server");
@@ -279,6 +304,36 @@ int main(int argc, char *argv[])
 					/* FIXME: for some reason so far only vmware needed it */
 					drmModeDirtyFB(fd, fb, NULL, 0);
 
+					if (moves) {
+						command = CMD_CURSOR;
+						step = 0;
+					}
+
+					/* fall through: start moving cursor */
+
+				case CMD_CURSOR:
+					if (command == CMD_CURSOR && step <= moves) {
+
+						/* diagonal sweep, hidden again after the last move; the
+						 * server applies only the latest position per vblank */
+						cx = (long) width * step / moves;
+						cy = (long) height * step / moves;
+
+						bzero(tx_buf, sizeof(tx_buf));
+						snprintf(tx_buf, sizeof(tx_buf), "%d:%d:%d:%d:%d:%d",
+							magic, command, crtc_id, cx, cy, step < moves);
+
+						step++;
+
+						ret = write(sockfd, tx_buf, sizeof(tx_buf));
+						if (ret < 0) {
+							perror("could not send cursor message to server");
+							goto err_fb;
+						}
+
+						break;
+					}
+
 					getchar();
 
 					command = CMD_CRTC_STOP;
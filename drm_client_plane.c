@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <error.h>
 #include <errno.h>
+#include <time.h>
 
 #include <xf86drmMode.h>
 #include <xf86drm.h>
@@ -31,7 +32,7 @@ int main(int argc, char *argv[])
 {
 	/* */
 
-	int ret, opt, i, imt = 0;
+	int ret, opt, i, imt = 0, nring = 0;
 
 	/* drm vars */
 
@@ -72,13 +73,30 @@ int main(int argc, char *argv[])
 
 	uint32_t command;
 
+	/* command ring */
+
+	struct drm_ring *ring = NULL;
+	struct drm_ring_cmd rcmd;
+	int ring_fds[2];
+	uint64_t bell = 1;
+	int dropped;
+
+	/* presentation feedback */
+
+	struct timespec commit_ts;
+	uint32_t seq, sec, usec;
+	long latency;
+
 	/* parse command line */
 
-	while ((opt = getopt(argc, argv, "t:x:y:w:v:c:p:m:h")) != -1) {
+	while ((opt = getopt(argc, argv, "r:t:x:y:w:v:c:p:m:h")) != -1) {
 		switch (opt) {
 			case 't':
 				imt = atoi(optarg);
 				break;
+			case 'r':
+				nring = atoi(optarg);
+				break;
 			case 'x':
 				posx = atoi(optarg);
 				break;
@@ -108,6 +126,7 @@ int main(int argc, char *argv[])
 				printf("\t-w <width>		plane width, default is 0'\n");
 				printf("\t-v <height>		plane height, default is 0'\n");
 				printf("\t-t <image>		image type, default is 0\n");
+				printf("\t-r <count>		move plane <count> times at 1kHz via command ring, default is 0\n");
 				exit(0);
 		}
 	}
@@ -282,7 +301,18 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
-			if (val != DRM_OK) {
+			if (val == DRM_PRESENTED) {
+				sscanf(rx_buf, "%d:%d:%u:%u:%u", &mag, &val, &seq, &sec, &usec);
+
+				latency = ((long) sec - commit_ts.tv_sec) * 1000000L +
+					(long) usec - commit_ts.tv_nsec / 1000;
+
+				fprintf(stdout, "presented at vblank %u: %u.%06u, latency %ld us\n",
+					seq, sec, usec, latency);
+				continue;
+			}
+
+			if (val != DRM_OK && val != DRM_COALESCED) {
 				fprintf(stdout, "got error from server, can't continue\n");
 				ret = -1;
 				break;
@@ -295,10 +325,11 @@ int main(int argc, char *argv[])
 					snprintf(tx_buf, sizeof(tx_buf), "%d:%d:%d:%d:%d:%d:%d:%d:%d",
 						magic, command, crtc_id, plane_id, fb, width, height, posx, posy);
 
+					clock_gettime(CLOCK_MONOTONIC, &commit_ts);
 					ret = write(sockfd, tx_buf, sizeof(tx_buf));
 					if (ret < 0) {
 						perror("could not send plane message to server");
-						goto err_fb;
+						goto err_ring;
 					}
 
 					break;
@@ -312,6 +343,33 @@ int main(int argc, char *argv[])
 					/* FIXME: for some reason so far only vmware needed it */
 					drmModeDirtyFB(fd, fb, NULL, 0);
 
+					if (nring > 0) {
+						ring = drm_ring_create(&ring_fds[0]);
+						if (!ring) {
+							ret = -1;
+							goto err_ring;
+						}
+
+						ring_fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+						if (ring_fds[1] < 0) {
+							perror("failed eventfd()");
+							ret = -1;
+							goto err_ring;
+						}
+
+						command = CMD_RING;
+						bzero(tx_buf, sizeof(tx_buf));
+						snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, command);
+
+						ret = drm_send_msg(sockfd, tx_buf, sizeof(tx_buf), ring_fds, 2);
+						if (ret < 0) {
+							perror("could not send ring message to server");
+							goto err_ring;
+						}
+
+						break;
+					}
+
 					getchar();
 
 					command = CMD_PLANE_STOP;
@@ -321,14 +379,48 @@ int main(int argc, char *argv[])
 					ret = write(sockfd, tx_buf, sizeof(tx_buf));
 					if (ret < 0) {
 						perror("could not send quit message to server");
-						goto err_fb;
+						goto err_ring;
+					}
+
+					break;
+
+				case CMD_RING:
+					rcmd.crtc_id = crtc_id;
+					rcmd.plane_id = plane_id;
+					rcmd.fb = fb;
+					rcmd.w = width;
+					rcmd.h = height;
+					rcmd.y = posy;
+
+					for (i = 0, dropped = 0; i < nring; i++) {
+						rcmd.x = posx + i % 256;
+
+						if (!drm_ring_push(ring, &rcmd)) {
+							dropped++;
+						} else {
+							write(ring_fds[1], &bell, sizeof(bell));
+						}
+
+						usleep(1000);
+					}
+
+					fprintf(stdout, "posted %d plane updates via ring, %d dropped\n", nring - dropped, dropped);
+
+					command = CMD_PLANE_STOP;
+					bzero(tx_buf, sizeof(tx_buf));
+					snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, command);
+
+					ret = write(sockfd, tx_buf, sizeof(tx_buf));
+					if (ret < 0) {
+						perror("could not send quit message to server");
+						goto err_ring;
 					}
 
 					break;
 
 				case CMD_PLANE_STOP:
 					fprintf(stdout, "server ok, quit...\n");
-					goto err_fb;
+					goto err_ring;
 
 				default:
 					fprintf(stderr, "skip unexpected command = %d\n", command);
@@ -340,7 +432,14 @@ int main(int argc, char *argv[])
 		}
 	}
 
-err_fb:
+err_ring:
+	if (ring) {
+		drm_ring_unmap(ring);
+		close(ring_fds[0]);
+		if (ring_fds[1] >= 0)
+			close(ring_fds[1]);
+	}
+
 	drmModeRmFB(fd, fb);
 
 err_buffer_unmap:
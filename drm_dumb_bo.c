@@ -44,6 +44,11 @@ int main(int argc, char *argv[])
 	uint64_t has_dumb;
 	int ret, fd;
 
+	struct drm_color_state saved_color;
+	struct drm_color_lut *lut = NULL;
+	bool faded = false;
+	int lut_size, i;
+
     struct drm_mode_destroy_dumb dreq;
 	struct drm_mode_create_dumb creq;
 	struct drm_mode_map_dumb mreq;
@@ -51,6 +56,7 @@ int main(int argc, char *argv[])
     drmModeCrtcPtr saved_crtc, current_crtc;
 
 	memset(&dbo, 0, sizeof(dbo));
+	memset(&saved_color, 0, sizeof(saved_color));
 
 	fd = open(device_name, O_RDWR | O_CLOEXEC);
 	if (fd < 0) {
@@ -152,6 +158,18 @@ int main(int argc, char *argv[])
 
     dump_crtc_configuration("saved_crtc", saved_crtc);
 
+	/* fade in by the display engine gamma LUT: the screen starts black, the
+	 * buffer is never touched again; previous color pipeline is put back on exit
+	 */
+
+	lut_size = drm_color_lut_size(fd, kms_data.crtc->crtc_id, false);
+	lut = lut_size > 1 ? calloc(lut_size, sizeof(*lut)) : NULL;
+
+	if (lut && !drm_color_save(fd, kms_data.crtc->crtc_id, &saved_color)) {
+		drm_color_lut_fill(lut, lut_size, 1.0, 0.0);
+		faded = !drm_color_set(fd, kms_data.crtc->crtc_id, NULL, 0, NULL, lut, lut_size);
+	}
+
 	/* setup new crtc */
 
     ret = drmModeSetCrtc(fd, kms_data.crtc->crtc_id, dbo.fb, 0, 0,
@@ -161,6 +179,8 @@ int main(int argc, char *argv[])
 		goto err_unmap;
 	}
 
+	drm_report_first_modeset();
+
     current_crtc = drmModeGetCrtc(fd, kms_data.crtc->crtc_id);
 
     if (current_crtc != NULL) {
@@ -176,6 +196,17 @@ int main(int argc, char *argv[])
     /* FIXME: for some reason so far only vmware needed it */
     drmModeDirtyFB(fd, dbo.fb, NULL, 0);
 
+	if (faded) {
+		for (i = 1; i <= 30; i++) {
+			usleep(33000);
+
+			drm_color_lut_fill(lut, lut_size, 1.0, i / 30.0);
+
+			if (drm_color_set(fd, kms_data.crtc->crtc_id, NULL, 0, NULL, lut, lut_size))
+				break;
+		}
+	}
+
     getchar();
 
 	/* restore old crtc */
@@ -190,6 +221,12 @@ int main(int argc, char *argv[])
     }
 
 err_unmap:
+	if (faded)
+		drm_color_restore(fd, kms_data.crtc->crtc_id, &saved_color);
+
+	drm_color_free(&saved_color);
+	free(lut);
+
     munmap(dbo.map, dbo.size);
 
 err_fb:
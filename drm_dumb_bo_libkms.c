@@ -146,6 +146,8 @@ int main(int argc, char *argv[])
 		goto err_buffer_unmap;
     }
 
+	drm_report_first_modeset();
+
     current_crtc = drmModeGetCrtc(fd, kms_data.crtc->crtc_id);
 
     if (current_crtc != NULL) {
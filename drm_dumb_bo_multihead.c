@@ -0,0 +1,462 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <error.h>
+#include <errno.h>
+#include <time.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "bitmap_utils.h"
+#include "drm_utils.h"
+
+/* */
+
+#define MAXOUTPUTS	8
+#define NUMBUFS		2
+
+struct dumb_rb {
+	uint32_t fb;
+	uint32_t handle;
+	uint32_t stride;
+	uint64_t size;
+
+	void *map;
+};
+
+/* one output: crtc driven from its own swapchain of dumb buffers */
+
+struct output {
+	struct kms_display kms;
+	drmModeCrtcPtr saved_crtc;
+	struct dumb_rb bufs[NUMBUFS];
+	int front;
+	bool pending;			/* page flip queued, event not received yet */
+
+	unsigned int last_frame;
+	unsigned long flips;
+	unsigned long missed;	/* vblanks passed without a new frame */
+	struct timespec ts;		/* start of current report interval */
+
+	bool vrr;				/* variable refresh rate enabled on crtc */
+	struct timespec due;		/* next flip not before this, irregular pacing */
+	struct timespec last_flip;
+	struct drm_time_stats interval;
+};
+
+/* */
+
+static const char device_name[] = "/dev/dri/card0";
+
+static struct output outputs[MAXOUTPUTS];
+static int noutputs = 0;
+
+static int jitter_ms = 0;
+
+/* */
+
+static int dumb_rb_create(int fd, struct dumb_rb *dbo, uint32_t width, uint32_t height)
+{
+	struct drm_mode_destroy_dumb dreq;
+	struct drm_mode_create_dumb creq;
+	struct drm_mode_map_dumb mreq;
+	int ret;
+
+	memset(dbo, 0, sizeof(*dbo));
+
+	memset(&creq, 0, sizeof(creq));
+	creq.height = height;
+	creq.width = width;
+	creq.bpp = 32;
+
+	ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
+	if (ret) {
+		perror("failed drmIoctl(DRM_IOCTL_MODE_CREATE_DUMB)");
+		return -1;
+	}
+
+	dbo->handle = creq.handle;
+	dbo->stride = creq.pitch;
+	dbo->size = creq.size;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = dbo->handle;
+
+	ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
+	if (ret) {
+		perror("failed drmIoctl(DRM_IOCTL_MODE_MAP_DUMB)");
+		goto err_destroy;
+	}
+
+	dbo->map = mmap(0, dbo->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
+	if (dbo->map == MAP_FAILED) {
+		perror("failed mmap()");
+		goto err_destroy;
+	}
+
+	ret = drmModeAddFB(fd, width, height, 24, 32, dbo->stride, dbo->handle, &dbo->fb);
+	if (ret) {
+		perror("failed drmModeAddFB()");
+		goto err_unmap;
+	}
+
+	return 0;
+
+err_unmap:
+	munmap(dbo->map, dbo->size);
+
+err_destroy:
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = dbo->handle;
+	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+
+	memset(dbo, 0, sizeof(*dbo));
+	return -1;
+}
+
+static void dumb_rb_destroy(int fd, struct dumb_rb *dbo)
+{
+	struct drm_mode_destroy_dumb dreq;
+
+	if (!dbo->handle)
+		return;
+
+	drmModeRmFB(fd, dbo->fb);
+	munmap(dbo->map, dbo->size);
+
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = dbo->handle;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq))
+		fprintf(stderr, "cannot destroy dumb buffer\n");
+}
+
+/* */
+
+static double elapsed_sec(struct timespec *from, struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
+static int output_flip(int fd, struct output *out)
+{
+	int next = (out->front + 1) % NUMBUFS;
+	int ret;
+
+	ret = drmModePageFlip(fd, out->kms.crtc->crtc_id, out->bufs[next].fb, DRM_MODE_PAGE_FLIP_EVENT, out);
+	if (ret) {
+		perror("failed drmModePageFlip");
+		return ret;
+	}
+
+	out->pending = true;
+	return 0;
+}
+
+/* flip events of all crtcs arrive here: each output runs at its own pace */
+
+static void page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
+{
+	struct output *out = data;
+	struct timespec now;
+	double dt;
+
+	out->pending = false;
+	out->front = (out->front + 1) % NUMBUFS;
+	out->flips++;
+
+	if (out->last_frame && frame - out->last_frame > 1)
+		out->missed += frame - out->last_frame - 1;
+
+	out->last_frame = frame;
+
+	if (out->last_flip.tv_sec)
+		drm_time_stats_add(&out->interval, drm_event_ms(&out->last_flip, sec, usec));
+
+	out->last_flip.tv_sec = sec;
+	out->last_flip.tv_nsec = usec * 1000;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	dt = elapsed_sec(&out->ts, &now);
+
+	/* irregular content: hold the next frame back by a random amount */
+
+	out->due = now;
+	if (jitter_ms) {
+		out->due.tv_nsec += (rand() % (jitter_ms * 1000)) * 1000L;
+		out->due.tv_sec += out->due.tv_nsec / 1000000000;
+		out->due.tv_nsec %= 1000000000;
+	}
+
+	if (dt >= 1.0) {
+		printf("output %d (crtc %u, %s%s): %.1f fps, %lu missed vblanks, interval %.2f/%.2f/%.2f ms\n",
+			(int) (out - outputs), out->kms.crtc->crtc_id, out->kms.mode->name,
+			out->vrr ? ", vrr" : "", out->flips / dt, out->missed,
+			out->interval.count ? out->interval.min : 0.0,
+			out->interval.count ? out->interval.sum / out->interval.count : 0.0,
+			out->interval.max);
+
+		out->flips = 0;
+		out->missed = 0;
+		out->ts = now;
+		memset(&out->interval, 0, sizeof(out->interval));
+	}
+}
+
+/* poll timeout until the earliest flip that is held back */
+
+static int next_flip_timeout(void)
+{
+	struct timespec now;
+	double wait, timeout = 1.0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < noutputs; i++) {
+		if (outputs[i].pending)
+			continue;
+
+		wait = elapsed_sec(&now, &outputs[i].due);
+		if (wait < timeout)
+			timeout = wait > 0.0 ? wait : 0.0;
+	}
+
+	return (int) (timeout * 1000.0 + 0.999);	/* round up, don't wake early */
+}
+
+static void usage(char *name)
+{
+	printf("usage: %s [-h] [-v] [-j <ms>]\n", name);
+	printf("\t-h: this help message\n");
+	printf("\t-v: variable refresh rate on vrr capable outputs\n");
+	printf("\t-j <ms>: irregular content, each frame is held up to <ms> longer;\n");
+	printf("\t\twith -v the refresh rate follows it, without it frames snap to vblanks\n");
+}
+
+/* */
+
+int main(int argc, char *argv[])
+{
+	drmEventContext evctx;
+	struct kms_display kms[MAXOUTPUTS];
+	struct timespec now;
+	struct pollfd fds[2];
+	struct output *out;
+	uint64_t has_dumb;
+	int ret, fd, i, j, opt;
+	bool running;
+	bool vrr = false;
+
+	while ((opt = getopt(argc, argv, "vj:h")) != -1) {
+		switch (opt) {
+		case 'v':
+			vrr = true;
+			break;
+		case 'j':
+			jitter_ms = atoi(optarg);
+			if (jitter_ms < 0)
+				jitter_ms = 0;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	fd = open(device_name, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror("cannot open drm device");
+		exit(-1);
+	}
+
+	drmSetMaster(fd);
+
+	/* DRM configuration: every connected output */
+
+	noutputs = drm_autoconf_all(fd, kms, MAXOUTPUTS);
+	if (noutputs <= 0) {
+		fprintf(stderr, "failed to autoconfigure KMS\n");
+		ret = -EFAULT;
+		goto err_close;
+	}
+
+	for (i = 0; i < noutputs; i++) {
+		outputs[i].kms = kms[i];
+		dump_drm_configuration(&outputs[i].kms);
+	}
+
+	/* check dumb buffer support */
+
+	if (drmGetCap(fd, DRM_CAP_DUMB_BUFFER, &has_dumb) < 0) {
+		perror("failed drmGetCap(DRM_CAP_DUMB_BUFFER)");
+		ret = -EFAULT;
+		goto err_close;
+	}
+
+	if (!has_dumb) {
+		fprintf(stderr, "driver does not support dumb buffers\n");
+		ret = -EFAULT;
+		goto err_close;
+	}
+
+	/* swapchains: buffers of one output differ so flips are visible */
+
+	for (i = 0; i < noutputs; i++) {
+		out = &outputs[i];
+
+		for (j = 0; j < NUMBUFS; j++) {
+			ret = dumb_rb_create(fd, &out->bufs[j], out->kms.mode->hdisplay, out->kms.mode->vdisplay);
+			if (ret) {
+				ret = -EFAULT;
+				goto err_buffers;
+			}
+
+			if (j % 2)
+				draw_fancy_image((uint32_t *) out->bufs[j].map, out->kms.mode->hdisplay, out->kms.mode->vdisplay);
+			else
+				draw_test_image((uint32_t *) out->bufs[j].map, out->kms.mode->hdisplay, out->kms.mode->vdisplay);
+		}
+	}
+
+	/* store current crtcs and setup new ones */
+
+	for (i = 0; i < noutputs; i++) {
+		out = &outputs[i];
+
+		out->saved_crtc = drmModeGetCrtc(fd, out->kms.crtc->crtc_id);
+		if (out->saved_crtc == NULL) {
+			perror("failed drmModeGetCrtc(current)");
+			ret = -EFAULT;
+			goto err_restore;
+		}
+
+		dump_crtc_configuration("saved_crtc", out->saved_crtc);
+
+		ret = drmModeSetCrtc(fd, out->kms.crtc->crtc_id, out->bufs[0].fb, 0, 0,
+				&out->kms.connector->connector_id, 1, out->kms.mode);
+		if (ret) {
+			perror("failed drmModeSetCrtc(new)");
+			goto err_restore;
+		}
+
+		drm_report_first_modeset();
+
+		/* missed vblanks lose meaning with vrr: vblank waits for the next flip */
+
+		if (vrr && drm_vrr_capable(fd, out->kms.connector->connector_id)) {
+			if (drm_vrr_enable(fd, out->kms.crtc->crtc_id, true))
+				perror("failed to enable vrr");
+			else
+				out->vrr = true;
+		}
+	}
+
+	/* start flipping on all outputs */
+
+	for (i = 0; i < noutputs; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &outputs[i].ts);
+		outputs[i].due = outputs[i].ts;
+		output_flip(fd, &outputs[i]);
+	}
+
+	/* one event loop for all crtcs, press Enter to stop */
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.page_flip_handler = page_flip_handler;
+
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = STDIN_FILENO;
+	fds[1].events = POLLIN;
+
+	running = true;
+
+	while (running) {
+
+		ret = poll(fds, 2, next_flip_timeout());
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("failed poll");
+			break;
+		}
+
+		if (fds[1].revents & POLLIN)
+			running = false;
+
+		if (fds[0].revents & POLLIN)
+			drmHandleEvent(fd, &evctx);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		for (i = 0; running && i < noutputs; i++) {
+			if (!outputs[i].pending && elapsed_sec(&outputs[i].due, &now) >= 0.0)
+				output_flip(fd, &outputs[i]);
+		}
+	}
+
+	/* wait for flips in flight: buffers must not go away under scanout */
+
+	for (i = 0; i < noutputs; i++) {
+		while (outputs[i].pending) {
+			fds[0].revents = 0;
+
+			if (poll(fds, 1, 100) <= 0)
+				break;
+
+			drmHandleEvent(fd, &evctx);
+		}
+	}
+
+	ret = 0;
+
+err_restore:
+
+	for (i = 0; i < noutputs; i++) {
+		out = &outputs[i];
+
+		if (!out->saved_crtc)
+			continue;
+
+		if (out->vrr)
+			drm_vrr_enable(fd, out->kms.crtc->crtc_id, false);
+
+		if (out->saved_crtc->mode_valid) {
+			if (drmModeSetCrtc(fd, out->saved_crtc->crtc_id, out->saved_crtc->buffer_id,
+					out->saved_crtc->x, out->saved_crtc->y,
+					&out->kms.connector->connector_id, 1, &out->saved_crtc->mode))
+				perror("failed drmModeSetCrtc(restore original)");
+		}
+
+		drmModeFreeCrtc(out->saved_crtc);
+	}
+
+err_buffers:
+
+	for (i = 0; i < noutputs; i++) {
+		for (j = 0; j < NUMBUFS; j++)
+			dumb_rb_destroy(fd, &outputs[i].bufs[j]);
+	}
+
+err_close:
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,525 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <gbm.h>
+
+#include "drm_utils.h"
+#include "gl_utils.h"
+
+/* */
+
+#ifndef GL_RGBA8
+#define GL_RGBA8    GL_RGBA8_OES
+#endif
+
+/*
+ * Same frame loop as drm_gl_test3 without KMS: no connector, no DRM master.
+ * Frames go to a ring of FBOs on a surfaceless EGL display, which needs no
+ * device at all and runs on llvmpipe, or on a gbm device opened on a render
+ * node. A frame slot is reused only once the fence of its previous frame has
+ * signalled, so up to 'depth' frames are in flight.
+ */
+
+#define MAXDEPTH    3
+
+struct HeadlessFb {
+    GLuint fbo;
+    GLuint color, depth;    /* renderbuffers */
+    EGLSyncKHR sync;        /* rendering of the last frame in this slot */
+};
+
+struct HeadlessFence {
+    bool enabled;
+    PFNEGLCREATESYNCKHRPROC createSync;
+    PFNEGLDESTROYSYNCKHRPROC destroySync;
+    PFNEGLCLIENTWAITSYNCKHRPROC clientWaitSync;
+};
+
+/*
+ * eglGetPlatformDisplay is EGL 1.5 core, EGL 1.4 stacks only have the
+ * EGL_EXT_platform_base variant. Both are looked up at run time, so the
+ * binary does not need a 1.5 libEGL either.
+ */
+
+static EGLDisplay getPlatformDisplay(const char *clientExtensions, EGLenum platform, void *native)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplayEXT;
+    PFNEGLGETPLATFORMDISPLAYPROC getPlatformDisplay;
+    const char *ver;
+    int major, minor;
+
+    if (strstr(clientExtensions, "EGL_EXT_platform_base")) {
+        getPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplayEXT)
+            return getPlatformDisplayEXT(platform, native, NULL);
+    }
+
+    /* the client version is only reported by 1.5 */
+
+    ver = eglQueryString(EGL_NO_DISPLAY, EGL_VERSION);
+    if (!ver || sscanf(ver, "%d.%d", &major, &minor) != 2 || major * 100 + minor < 105) {
+        fprintf(stderr, "No support for EGL_EXT_platform_base or EGL 1.5\n");
+        return EGL_NO_DISPLAY;
+    }
+
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYPROC) eglGetProcAddress("eglGetPlatformDisplay");
+    if (!getPlatformDisplay) {
+        fprintf(stderr, "No eglGetPlatformDisplay entry point\n");
+        return EGL_NO_DISPLAY;
+    }
+
+    return getPlatformDisplay(platform, native, NULL);
+}
+
+/* */
+
+static bool fbCreate(struct HeadlessFb *fb, int width, int height)
+{
+    glGenRenderbuffers(1, &fb->color);
+    glBindRenderbuffer(GL_RENDERBUFFER, fb->color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &fb->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, fb->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+
+    glGenFramebuffers(1, &fb->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, fb->color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fb->depth);
+
+    fb->sync = EGL_NO_SYNC_KHR;
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "framebuffer %dx%d is incomplete\n", width, height);
+        return false;
+    }
+
+    return true;
+}
+
+static void fbDestroy(struct HeadlessFb *fb)
+{
+    glDeleteFramebuffers(1, &fb->fbo);
+    glDeleteRenderbuffers(1, &fb->depth);
+    glDeleteRenderbuffers(1, &fb->color);
+}
+
+/* wait for the previous frame in this slot, true if it had to block */
+
+static bool fbWait(EGLDisplay dpy, struct HeadlessFence *fence, struct HeadlessFb *fb)
+{
+    EGLint status;
+
+    if (fb->sync == EGL_NO_SYNC_KHR)
+        return false;
+
+    status = fence->clientWaitSync(dpy, fb->sync, 0, 0);
+    if (status == EGL_TIMEOUT_EXPIRED_KHR)
+        fence->clientWaitSync(dpy, fb->sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+
+    fence->destroySync(dpy, fb->sync);
+    fb->sync = EGL_NO_SYNC_KHR;
+
+    return status == EGL_TIMEOUT_EXPIRED_KHR;
+}
+
+static bool fbBusy(EGLDisplay dpy, struct HeadlessFence *fence, struct HeadlessFb *fb)
+{
+    if (!fence->enabled || !fb || fb->sync == EGL_NO_SYNC_KHR)
+        return false;
+
+    return fence->clientWaitSync(dpy, fb->sync, 0, 0) == EGL_TIMEOUT_EXPIRED_KHR;
+}
+
+
+/* frames whose rendering has not finished yet */
+
+static int fbInflight(EGLDisplay dpy, struct HeadlessFence *fence, struct HeadlessFb *ring, int depth)
+{
+    int i, n = 0;
+
+    for (i = 0; i < depth; i++)
+        if (fbBusy(dpy, fence, &ring[i]))
+            n++;
+
+    return n;
+}
+
+static int headlessFenceInit(const char *extensions, struct HeadlessFence *fence)
+{
+    fence->enabled = false;
+
+    if (!strstr(extensions, "EGL_KHR_fence_sync")) {
+        printf("No support for EGL_KHR_fence_sync\n");
+        return -1;
+    }
+
+    fence->createSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+    fence->destroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+    fence->clientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress("eglClientWaitSyncKHR");
+
+    if (!fence->createSync || !fence->destroySync || !fence->clientWaitSync) {
+        printf("No EGL fence sync entry points\n");
+        return -1;
+    }
+
+    fence->enabled = true;
+    return 0;
+}
+
+/* last frame as binary PPM, rows flipped to top-down */
+
+static int savePPM(const char *path, int width, int height)
+{
+    unsigned char *pixels;
+    FILE *f;
+    int x, y;
+
+    pixels = malloc((size_t) width * height * 4);
+    if (!pixels)
+        return -1;
+
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        free(pixels);
+        return -1;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for (y = height - 1; y >= 0; y--) {
+        unsigned char *row = pixels + (size_t) y * width * 4;
+
+        for (x = 0; x < width; x++)
+            fwrite(row + x * 4, 1, 3, f);
+    }
+
+    fclose(f);
+    free(pixels);
+
+    return 0;
+}
+
+/* */
+
+static void usage(char *name)
+{
+    printf("usage: %s [-h] [-p <platform>] [-r <node>] [-g <w>x<h>] [-d <depth>] [-f <frames>] [-A <gl|gles>] [-s <stress>] [-o <file>]\n", name);
+    printf("\t-h: this help message\n");
+    printf("\t-p <platform>: surfaceless (default, no device needed) or gbm\n");
+    printf("\t-r <node>: render node for gbm, default is /dev/dri/renderD128\n");
+    printf("\t-g <w>x<h>: framebuffer size, default is 1920x1080\n");
+    printf("\t-d <depth>: frames in flight, 1..%d, default is 2\n", MAXDEPTH);
+    printf("\t-f <frames>: number of frames to render, default is 300\n");
+    printf("\t-A <api>: client API, desktop GL or GLES 2/3, default is %s\n", gl_api_name());
+    printf("\t-s objects=N,layers=N,alu=N,texture=N: GPU stress scene instead of the triangle,\n");
+    printf("\t\tomitted keys use 1024 objects, 4 layers, 8 alu iterations, 1024 texture\n");
+    printf("\t-o <file>: save the last frame as PPM\n");
+}
+
+/* */
+
+int main(int argc, char *argv[])
+{
+    EGLDisplay dpy;
+    EGLContext ctx;
+    EGLint major, minor;
+    EGLConfig eglConfig = EGL_NO_CONFIG_KHR;
+    EGLint n = 0;
+
+    const char *ver, *extensions, *clientExtensions;
+
+    struct gbm_device *gbm = NULL;
+    const char *platform = "surfaceless";
+    const char *node = "/dev/dri/renderD128";
+    int fd = -1;
+
+    struct HeadlessFb ring[MAXDEPTH] = { 0 };
+    struct HeadlessFb *fb, *last = NULL;
+    struct HeadlessFence fence = { 0 };
+    int depth = 2;
+    int created = 0;
+
+    struct drm_frame_stats stats = { 0 };
+    struct timespec start, ts, renderTs;
+    double total;
+
+    int width = 1920, height = 1080;
+    int frames = 300;
+    const char *output = NULL;
+
+    struct gl_stress_params stressParams = GL_STRESS_DEFAULTS;
+    bool stressScene = false;
+
+    float angle = 0.0;
+    int ret = 0, i, opt;
+
+    while ((opt = getopt(argc, argv, "p:r:g:d:f:A:s:o:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                platform = optarg;
+                break;
+            case 'r':
+                node = optarg;
+                break;
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+                    fprintf(stderr, "bad size '%s', expected <w>x<h>\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'A':
+                if (!gl_set_api(optarg))
+                    return -1;
+                break;
+            case 's':
+                if (!gl_stress_parse(&stressParams, optarg))
+                    return -1;
+                stressScene = true;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 0;
+        }
+    }
+
+    if (depth < 1 || depth > MAXDEPTH) {
+        fprintf(stderr, "frames in flight must be 1..%d\n", MAXDEPTH);
+        return -1;
+    }
+
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "bad framebuffer size %dx%d\n", width, height);
+        return -1;
+    }
+
+    /* the platforms are client extensions */
+
+    clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (!clientExtensions) {
+        fprintf(stderr, "no EGL client extensions\n");
+        return -1;
+    }
+
+    if (!strcmp(platform, "surfaceless")) {
+        if (!strstr(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+            fprintf(stderr, "No support for EGL_MESA_platform_surfaceless\n");
+            return -1;
+        }
+
+        dpy = getPlatformDisplay(clientExtensions, EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY);
+    } else if (!strcmp(platform, "gbm")) {
+        if (!strstr(clientExtensions, "EGL_KHR_platform_gbm") &&
+                !strstr(clientExtensions, "EGL_MESA_platform_gbm")) {
+            fprintf(stderr, "No support for EGL_KHR_platform_gbm\n");
+            return -1;
+        }
+
+        /* a render node needs no DRM master and no modesetting rights */
+
+        fd = open(node, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "couldn't open %s: %m\n", node);
+            return -1;
+        }
+
+        gbm = gbm_create_device(fd);
+        if (gbm == NULL) {
+            fprintf(stderr, "couldn't create gbm device\n");
+            ret = -1;
+            goto close_fd;
+        }
+
+        dpy = getPlatformDisplay(clientExtensions, EGL_PLATFORM_GBM_KHR, gbm);
+    } else {
+        fprintf(stderr, "unknown platform '%s', use surfaceless or gbm\n", platform);
+        return -1;
+    }
+
+    if (dpy == EGL_NO_DISPLAY) {
+        fprintf(stderr, "failed to get %s display\n", platform);
+        ret = -1;
+        goto destroy_gbm_device;
+    }
+
+    if (!eglInitialize(dpy, &major, &minor)) {
+        printf("eglInitialize() failed\n");
+        ret = -1;
+        goto egl_terminate;
+    }
+
+    ver = eglQueryString(dpy, EGL_VERSION);
+    printf("EGL_VERSION = %s (%s platform)\n", ver, platform);
+
+    extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+    printf("EGL_EXTENSIONS: %s\n", extensions);
+
+    if (!strstr(extensions, "EGL_KHR_surfaceless_context")) {
+        printf("No support for EGL_KHR_surfaceless_context\n");
+        ret = -1;
+        goto egl_terminate;
+    }
+
+    /* nothing is ever drawn to an EGL surface, so any config for the API will do */
+
+    if (!strstr(extensions, "EGL_KHR_no_config_context")) {
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, 0,
+            EGL_RENDERABLE_TYPE, gl_renderable_type(),
+            EGL_NONE
+        };
+
+        if (!eglChooseConfig(dpy, configAttribs, &eglConfig, 1, &n) || n != 1)
+        {
+            fprintf(stderr, "failed to choose config\n");
+            ret = -1;
+            goto egl_terminate;
+        }
+    }
+
+    ctx = gl_context_create(dpy, eglConfig);
+    if (!ctx)
+    {
+        fprintf(stderr, "failed to create context\n");
+        ret = -1;
+        goto egl_terminate;
+    }
+
+    if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        fprintf(stderr, "failed to make context current\n");
+        ret = -1;
+        goto destroy_context;
+    }
+
+    if (!gl_scene_init(stressScene ? &stressParams : NULL)) {
+        fprintf(stderr, "failed to set up renderer\n");
+        ret = -1;
+        goto unmake_current;
+    }
+
+    for (created = 0; created < depth; created++) {
+        if (!fbCreate(&ring[created], width, height)) {
+            created++;
+            ret = -1;
+            goto destroy_fbs;
+        }
+    }
+
+    /* a single slot is the same as glFinish after every frame */
+
+    if (depth > 1 && headlessFenceInit(extensions, &fence)) {
+        printf("fence sync is not available, use glFinish\n");
+        depth = 1;
+    }
+
+    printf("rendering %d frames %dx%d\n", frames, width, height);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < frames; i++) {
+        fb = &ring[i % depth];
+
+        /* block only when the oldest frame in flight still uses this slot */
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        if (fence.enabled)
+            fbWait(dpy, &fence, fb);
+
+        stats.blocked += drm_elapsed(&ts);
+
+        if (fbBusy(dpy, &fence, last))
+            stats.overlapped++;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fb->fbo);
+
+        clock_gettime(CLOCK_MONOTONIC, &renderTs);
+
+        gl_scene_frame(width, height, angle);
+
+        if (fence.enabled) {
+            fb->sync = fence.createSync(dpy, EGL_SYNC_FENCE_KHR, NULL);
+            glFlush();
+        } else {
+            glFinish();
+        }
+
+        drm_time_stats_add(&stats.render, drm_elapsed(&renderTs) * 1000.0);
+
+        angle += 1.0;
+        last = fb;
+
+        stats.cpu_busy += drm_elapsed(&ts);
+        stats.inflight += fence.enabled ? fbInflight(dpy, &fence, ring, depth) : 0;
+        stats.frames++;
+    }
+
+    /* drain the pipeline */
+
+    for (i = 0; i < depth && fence.enabled; i++)
+        fbWait(dpy, &fence, &ring[i]);
+
+    glFinish();
+
+    total = drm_elapsed(&start);
+
+    drm_frame_stats_dump(&stats, total, depth, fence.enabled, gl_api_name());
+    gl_scene_report(stats.frames, total, width, height);
+
+    if (output && last) {
+        glBindFramebuffer(GL_FRAMEBUFFER, last->fbo);
+        if (savePPM(output, width, height))
+            ret = -1;
+        else
+            printf("last frame saved to %s\n", output);
+    }
+
+destroy_fbs:
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    for (i = 0; i < created; i++)
+        fbDestroy(&ring[i]);
+
+unmake_current:
+    gl_scene_fini();
+    eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+destroy_context:
+    eglDestroyContext(dpy, ctx);
+
+egl_terminate:
+    eglTerminate(dpy);
+
+destroy_gbm_device:
+    if (gbm)
+        gbm_device_destroy(gbm);
+
+close_fd:
+    if (fd >= 0)
+        close(fd);
+
+    return ret;
+}
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <getopt.h>
 #include <fcntl.h>
 
 #define EGL_EGLEXT_PROTOTYPES
@@ -64,8 +65,21 @@ int main(int argc, char *argv[])
 	const char *ver, *extensions;
 	uint32_t handle, stride, fb_id;
 	struct kms_display kms;
-	int ret, fd, i;
-
+	int ret, fd, i, opt;
+
+	while ((opt = getopt(argc, argv, "A:h")) != -1) {
+		switch (opt) {
+			case 'A':
+				if (!gl_set_api(optarg))
+					return -1;
+				break;
+			case 'h':
+			default:
+				printf("usage: %s [-h] [-A <gl|gles>]\n", argv[0]);
+				printf("\t-A <api>: client API, desktop GL or GLES 2/3, default is %s\n", gl_api_name());
+				return 0;
+		}
+	}
 
 	fd = open(device_name, O_RDWR);
 	if (fd < 0) {
@@ -118,9 +132,7 @@ int main(int argc, char *argv[])
 		goto egl_terminate;
 	}
 
-	eglBindAPI(EGL_OPENGL_API);
-
-	ctx = eglCreateContext(dpy, NULL, EGL_NO_CONTEXT, NULL);
+	ctx = gl_context_create(dpy, NULL);
 	if (ctx == NULL) {
 		fprintf(stderr, "failed to create context\n");
 		ret = -1;
@@ -133,6 +145,14 @@ int main(int argc, char *argv[])
 		goto destroy_context;
 	}
 
+	/* shaders, buffers and fixed state are set up once for the whole run */
+
+	if (!render_init()) {
+		fprintf(stderr, "failed to set up renderer\n");
+		ret = -1;
+		goto unmake_current;
+	}
+
 #ifdef GL_OES_EGL_image
 	glEGLImageTargetRenderbufferStorageOES_func =
 		(PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC)
@@ -202,6 +222,8 @@ int main(int argc, char *argv[])
 		goto free_saved_crtc;
 	}
 
+	drm_report_first_modeset();
+
     current_crtc = drmModeGetCrtc(fd, kms.crtc->crtc_id);
 
     if (current_crtc != NULL) {
@@ -259,6 +281,7 @@ rm_fb:
 destroy_gbm_bo:
 	gbm_bo_destroy(bo);
 unmake_current:
+	render_fini();
 	eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 destroy_context:
 	eglDestroyContext(dpy, ctx);
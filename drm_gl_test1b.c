@@ -25,7 +25,9 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <getopt.h>
 #include <fcntl.h>
+#include <time.h>
 
 #define EGL_EGLEXT_PROTOTYPES
 
@@ -45,6 +47,17 @@ static PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC glEGLImageTargetRenderbuffe
 
 static const char device_name[] = "/dev/dri/card0";
 
+/* render to scanout latency: flip event carries the time buffer hit the screen */
+
+static struct drm_time_stats latency;
+
+static void flipHandler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
+{
+    struct timespec *render_ts = (struct timespec *) data;
+
+    drm_time_stats_add(&latency, drm_event_ms(render_ts, sec, usec));
+}
+
 int main(int argc, char *argv[])
 {
     EGLDisplay dpy;
@@ -64,10 +77,34 @@ int main(int argc, char *argv[])
     uint32_t fb_id[2];
     uint32_t fbo;
 
+    drmEventContext evctx;
+    struct timespec render_ts;
+    uint32_t flags;
+    int async = 0;
+    int opt;
+
     float angle = 0.0;
     uint32_t current;
     int ret, fd, i;
 
+    while ((opt = getopt(argc, argv, "aA:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                async = 1;
+                break;
+            case 'A':
+                if (!gl_set_api(optarg))
+                    return -1;
+                break;
+            case 'h':
+            default:
+                printf("usage: %s [-h] [-a] [-A <gl|gles>]\n", argv[0]);
+                printf("\t-a: async flips, don't wait for vblank (tearing)\n");
+                printf("\t-A <api>: client API, desktop GL or GLES 2/3, default is %s\n", gl_api_name());
+                return 0;
+        }
+    }
+
 	fd = open(device_name, O_RDWR);
 	if (fd < 0) {
 		/* Probably permissions error */
@@ -119,9 +156,7 @@ int main(int argc, char *argv[])
         goto egl_terminate;
     }
 
-    eglBindAPI(EGL_OPENGL_API);
-
-    ctx = eglCreateContext(dpy, NULL, EGL_NO_CONTEXT, NULL);
+    ctx = gl_context_create(dpy, NULL);
     if (ctx == NULL) {
         fprintf(stderr, "failed to create context\n");
         ret = -1;
@@ -134,6 +169,14 @@ int main(int argc, char *argv[])
         goto destroy_context;
     }
 
+    /* shaders, buffers and fixed state are set up once for the whole run */
+
+    if (!render_init()) {
+        fprintf(stderr, "failed to set up renderer\n");
+        ret = -1;
+        goto unmake_current;
+    }
+
 #ifdef GL_OES_EGL_image
     glEGLImageTargetRenderbufferStorageOES_func =
         (PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC)
@@ -215,8 +258,21 @@ int main(int argc, char *argv[])
         goto free_saved_crtc;
     }
 
+    drm_report_first_modeset();
+
+    if (async && !drm_async_flip_supported(fd, false)) {
+        printf("async flips are not supported, use vsync\n");
+        async = 0;
+    }
+
+    memset(&evctx, 0, sizeof(evctx));
+    evctx.version = DRM_EVENT_CONTEXT_VERSION;
+    evctx.page_flip_handler = flipHandler;
+
     for(i = 0; i < 50; i++) {
 
+        clock_gettime(CLOCK_MONOTONIC, &render_ts);
+
         glFramebufferRenderbuffer(GL_FRAMEBUFFER,
 							  GL_COLOR_ATTACHMENT0,
 							  GL_RENDERBUFFER,
@@ -231,10 +287,22 @@ int main(int argc, char *argv[])
 
         render_stuff(kms.mode->hdisplay, kms.mode->vdisplay, angle);
 
-        if (drmModePageFlip(fd, kms.crtc->crtc_id, fb_id[current], 0, NULL) < 0) {
+        flags = DRM_MODE_PAGE_FLIP_EVENT | (async ? DRM_MODE_PAGE_FLIP_ASYNC : 0);
+        ret = drmModePageFlip(fd, kms.crtc->crtc_id, fb_id[current], flags, &render_ts);
+
+        if (ret < 0 && async) {
+            fprintf(stderr, "async flip rejected, fall back to vsync\n");
+            async = 0;
+            ret = drmModePageFlip(fd, kms.crtc->crtc_id, fb_id[current], DRM_MODE_PAGE_FLIP_EVENT, &render_ts);
+        }
+
+        if (ret < 0) {
             fprintf(stderr, "queueing pageflip failed\n");
     	} else {
             fprintf(stderr, "queueing ok\n");
+
+            /* wait for the flip: render_ts must stay valid, next flip would be rejected */
+            drmHandleEvent(fd, &evctx);
         }
 
         /*
@@ -249,6 +317,8 @@ int main(int argc, char *argv[])
         usleep(50000);
     }
 
+    drm_time_stats_dump(&latency, async ? "render to scanout (async)" : "render to scanout (vsync)");
+
     ret = drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
             saved_crtc->x, saved_crtc->y,
             &kms.connector->connector_id, 1, &saved_crtc->mode);
@@ -275,6 +345,7 @@ destroy_gbm_bo:
     gbm_bo_destroy(bo[0]);
     gbm_bo_destroy(bo[1]);
 unmake_current:
+    render_fini();
     eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 destroy_context:
     eglDestroyContext(dpy, ctx);
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <getopt.h>
 #include <fcntl.h>
 
 #define EGL_EGLEXT_PROTOTYPES
@@ -64,7 +65,21 @@ int main(int argc, char *argv[])
     uint32_t fb_id;
 
     float angle = 0.0;
-    int ret, fd, i;
+    int ret, fd, i, opt;
+
+    while ((opt = getopt(argc, argv, "A:h")) != -1) {
+        switch (opt) {
+            case 'A':
+                if (!gl_set_api(optarg))
+                    return -1;
+                break;
+            case 'h':
+            default:
+                printf("usage: %s [-h] [-A <gl|gles>]\n", argv[0]);
+                printf("\t-A <api>: client API, desktop GL or GLES 2/3, default is %s\n", gl_api_name());
+                return 0;
+        }
+    }
 
 	fd = open(device_name, O_RDWR);
 	if (fd < 0) {
@@ -121,15 +136,13 @@ int main(int argc, char *argv[])
         goto egl_terminate;
     }
 
-    eglBindAPI(EGL_OPENGL_API);
-
-    static const EGLint configAttribs[] = {
+    const EGLint configAttribs[] = {
         EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
         EGL_RED_SIZE,   1,
         EGL_GREEN_SIZE, 1,
         EGL_BLUE_SIZE,  1,
         EGL_ALPHA_SIZE, 0,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RENDERABLE_TYPE, gl_renderable_type(),
         EGL_NONE
     };
 
@@ -140,12 +153,7 @@ int main(int argc, char *argv[])
         goto egl_terminate;
     }
 
-    EGLint contextAttrs[] = {
-        EGL_CONTEXT_CLIENT_VERSION, 2,
-        EGL_NONE
-    };
-
-    ctx = eglCreateContext(dpy, eglConfig, EGL_NO_CONTEXT, contextAttrs);
+    ctx = gl_context_create(dpy, eglConfig);
     if (!ctx)
     {
         fprintf(stderr, "failed to create context\n");
@@ -159,6 +167,14 @@ int main(int argc, char *argv[])
         goto destroy_context;
     }
 
+    /* shaders, buffers and fixed state are set up once for the whole run */
+
+    if (!render_init()) {
+        fprintf(stderr, "failed to set up renderer\n");
+        ret = -1;
+        goto unmake_current;
+    }
+
     /* */
 
     surface = gbm_surface_create(gbm, kms.mode->hdisplay, kms.mode->vdisplay, GBM_BO_FORMAT_XRGB8888, GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
@@ -224,6 +240,8 @@ int main(int argc, char *argv[])
         goto free_saved_crtc;
     }
 
+    drm_report_first_modeset();
+
     for(i = 0; i < 10; i++) {
 
         render_stuff(kms.mode->hdisplay, kms.mode->vdisplay, angle);
@@ -248,6 +266,7 @@ free_saved_crtc:
 rm_fb:
     drmModeRmFB(fd, fb_id);
 unmake_current:
+    render_fini();
     eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 destroy_context:
     eglDestroyContext(dpy, ctx);
@@ -25,7 +25,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <getopt.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/ioctl.h>
+#include <linux/sync_file.h>
 
 #define EGL_EGLEXT_PROTOTYPES
 
@@ -47,13 +53,78 @@ struct DrmFb {
     struct DrmOutput *output;
     struct gbm_bo *bo;
     uint32_t fbid;
+    int gpuFence;           /* rendering of the last frame in this buffer, -1 if done */
+    struct timespec renderTs;   /* rendering of the last frame started */
 };
 
+/*
+ * Frames in flight: up to 'depth' gbm buffers are locked at a time - one on
+ * screen, one being flipped to and the rest rendered and queued. Rendering
+ * blocks only when all of them are busy.
+ */
+
+#define MAXDEPTH    3
+
 struct DrmOutput {
     struct gbm_surface *surface;
     EGLSurface  eglSurface;
-    struct DrmFb *current, *next;
+    struct DrmFb *current, *next;   /* on screen, flip in flight */
     int pageFlipPending;
+
+    struct DrmFb *queue[MAXDEPTH];  /* rendered, waiting for a flip */
+    int qhead;
+    int qcount;
+
+    struct DrmFb *last;             /* most recently rendered frame */
+    int locked;                     /* front buffers taken from gbm surface */
+    int depth;
+
+    int async;                      /* flip immediately, don't wait for vblank */
+    struct drm_time_stats latency;  /* render start to scanout */
+
+    int vrr;                        /* variable refresh: scanout follows flips */
+    struct timespec lastScanout;
+    struct drm_time_stats interval; /* between scanouts of consecutive frames */
+};
+
+/*
+ * Explicit fencing: GPU fence of a frame goes to the kernel as plane
+ * IN_FENCE_FD, so scanout waits for rendering instead of the CPU doing
+ * glFinish; OUT_FENCE_PTR of the commit signals when the previous buffer
+ * left the screen, only then it is given back to gbm for rendering.
+ */
+
+/* property ids are looked up once, every frame adds them by id */
+
+enum { CONN_CRTC_ID, CONN_NPROPS };
+enum { CRTC_MODE_ID, CRTC_ACTIVE, CRTC_VRR_ENABLED, CRTC_OUT_FENCE_PTR, CRTC_NPROPS };
+enum {
+    PLANE_FB_ID, PLANE_CRTC_ID, PLANE_SRC_X, PLANE_SRC_Y, PLANE_SRC_W, PLANE_SRC_H,
+    PLANE_CRTC_X, PLANE_CRTC_Y, PLANE_CRTC_W, PLANE_CRTC_H, PLANE_IN_FENCE_FD, PLANE_NPROPS
+};
+
+static const char * const connPropNames[CONN_NPROPS] = { "CRTC_ID" };
+static const char * const crtcPropNames[CRTC_NPROPS] = { "MODE_ID", "ACTIVE", "VRR_ENABLED", "OUT_FENCE_PTR" };
+static const char * const planePropNames[PLANE_NPROPS] = {
+    "FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+    "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H", "IN_FENCE_FD"
+};
+
+struct DrmFence {
+    int enabled;
+
+    PFNEGLCREATESYNCKHRPROC createSync;
+    PFNEGLDESTROYSYNCKHRPROC destroySync;
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC dupNativeFenceFd;
+
+    uint32_t planeId;
+    uint32_t modeBlob;
+
+    uint32_t connProps[CONN_NPROPS];
+    uint32_t crtcProps[CRTC_NPROPS];
+    uint32_t planeProps[PLANE_NPROPS];
+
+    int kmsFence;           /* out fence of the commit in flight, -1 if none */
 };
 
 /* */
@@ -62,23 +133,73 @@ static const char device_name[] = "/dev/dri/card0";
 
 /* */
 
-static void pageFlipHandler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
+static int fenceBusy(int fenceFd)
 {
-    struct DrmOutput *output = (struct DrmOutput *) data;
+    struct pollfd pfd = { .fd = fenceFd, .events = POLLIN };
 
-    fprintf(stdout, "-> %s\n", __func__);
+    return fenceFd != -1 && poll(&pfd, 1, 0) == 0;
+}
+
+/* time the kernel signalled the fence */
+
+static int fenceTimestamp(int fenceFd, struct timespec *ts)
+{
+    struct sync_fence_info fence;
+    struct sync_file_info info;
+
+    memset(&fence, 0, sizeof(fence));
+    memset(&info, 0, sizeof(info));
+    info.num_fences = 1;
+    info.sync_fence_info = (uint64_t) (unsigned long) &fence;
+
+    if (ioctl(fenceFd, SYNC_IOC_FILE_INFO, &info) || info.status != 1)
+        return -1;
+
+    ts->tv_sec = fence.timestamp_ns / 1000000000ULL;
+    ts->tv_nsec = fence.timestamp_ns % 1000000000ULL;
+    return 0;
+}
+
+/* flip done: previous buffer is off screen and may be rendered into again */
+
+static void drmFlipDone(struct DrmOutput *output, unsigned int sec, unsigned int usec)
+{
+    if (output->next && (sec || usec)) {
+        drm_time_stats_add(&output->latency, drm_event_ms(&output->next->renderTs, sec, usec));
+
+        if (output->lastScanout.tv_sec)
+            drm_time_stats_add(&output->interval, drm_event_ms(&output->lastScanout, sec, usec));
+
+        output->lastScanout.tv_sec = sec;
+        output->lastScanout.tv_nsec = usec * 1000;
+    }
 
     output->pageFlipPending = 0;
 
     if (output->current)
     {
+        if (output->current->gpuFence != -1) {
+            close(output->current->gpuFence);
+            output->current->gpuFence = -1;
+        }
+
         gbm_surface_release_buffer(output->surface, output->current->bo);
+        output->locked--;
     }
 
     output->current = output->next;
     output->next = NULL;
 }
 
+static void pageFlipHandler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
+{
+    struct DrmOutput *output = (struct DrmOutput *) data;
+
+    fprintf(stdout, "-> %s\n", __func__);
+
+    drmFlipDone(output, sec, usec);
+}
+
 static int
 onDrmInput(int fd)
 {
@@ -128,6 +249,7 @@ struct DrmFb* drmFbGetFromBo(struct gbm_bo *bo, int fdDev, struct DrmOutput *out
     fb = (struct DrmFb*) calloc(sizeof(*fb), 1);
     fb->bo = bo;
     fb->output = output;
+    fb->gpuFence = -1;
 
     width = gbm_bo_get_width(bo);
     height = gbm_bo_get_height(bo);
@@ -145,6 +267,317 @@ struct DrmFb* drmFbGetFromBo(struct gbm_bo *bo, int fdDev, struct DrmOutput *out
     return fb;
 }
 
+static int drmFenceInit(int fd, EGLDisplay dpy, const char *extensions,
+        struct kms_display *kms, struct DrmFence *fence)
+{
+    fprintf(stdout, "-> %s\n", __func__);
+
+    fence->kmsFence = -1;
+
+    if (!strstr(extensions, "EGL_ANDROID_native_fence_sync")) {
+        printf("No support for EGL_ANDROID_native_fence_sync\n");
+        return -1;
+    }
+
+    fence->createSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+    fence->destroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+    fence->dupNativeFenceFd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC) eglGetProcAddress("eglDupNativeFenceFDANDROID");
+
+    if (!fence->createSync || !fence->destroySync || !fence->dupNativeFenceFd) {
+        printf("No EGL fence sync entry points\n");
+        return -1;
+    }
+
+    if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+        printf("No support for atomic modesetting\n");
+        return -1;
+    }
+
+    fence->planeId = drm_get_primary_plane(fd, kms->crtc->crtc_id);
+    if (!fence->planeId) {
+        printf("No primary plane for crtc %u\n", kms->crtc->crtc_id);
+        goto err_cap;
+    }
+
+    drm_get_prop_ids(fd, kms->connector->connector_id, DRM_MODE_OBJECT_CONNECTOR,
+            connPropNames, fence->connProps, CONN_NPROPS);
+    drm_get_prop_ids(fd, kms->crtc->crtc_id, DRM_MODE_OBJECT_CRTC,
+            crtcPropNames, fence->crtcProps, CRTC_NPROPS);
+
+    /* VRR_ENABLED is optional, the rest is needed by every commit */
+
+    if (!fence->connProps[CONN_CRTC_ID] || !fence->crtcProps[CRTC_MODE_ID] ||
+            !fence->crtcProps[CRTC_ACTIVE] || !fence->crtcProps[CRTC_OUT_FENCE_PTR] ||
+            drm_get_prop_ids(fd, fence->planeId, DRM_MODE_OBJECT_PLANE,
+                planePropNames, fence->planeProps, PLANE_NPROPS) != PLANE_NPROPS) {
+        printf("No support for explicit fencing in KMS\n");
+        goto err_cap;
+    }
+
+    if (drmModeCreatePropertyBlob(fd, kms->mode, sizeof(*kms->mode), &fence->modeBlob)) {
+        perror("failed drmModeCreatePropertyBlob");
+        goto err_cap;
+    }
+
+    fence->enabled = 1;
+    return 0;
+
+err_cap:
+    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 0);
+    return -1;
+}
+
+/*
+ * Async atomic flips may only change FB_ID (and fences) of the primary
+ * plane, so completion is reported by a page flip event instead of
+ * OUT_FENCE_PTR.
+ */
+
+static int drmAtomicAdd(drmModeAtomicReq *req, uint32_t objId, uint32_t propId, uint64_t value)
+{
+    if (!propId) {
+        fprintf(stderr, "object %u lacks a property\n", objId);
+        return -1;
+    }
+
+    return drmModeAtomicAddProperty(req, objId, propId, value) < 0 ? -1 : 0;
+}
+
+static int drmAtomicCommit(int fd, struct kms_display *kms, struct DrmFence *fence,
+        uint32_t fbid, int inFence, int modeset, struct DrmOutput *output)
+{
+    drmModeAtomicReq *req;
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK;
+    int async = output->async && !modeset;
+    uint32_t plane = fence->planeId;
+    uint32_t crtc = kms->crtc->crtc_id;
+    uint32_t *pp = fence->planeProps;
+    uint32_t *cp = fence->crtcProps;
+    int ret = 0;
+
+    req = drmModeAtomicAlloc();
+    if (!req)
+        return -1;
+
+    if (modeset) {
+        flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+        ret |= drmAtomicAdd(req, kms->connector->connector_id, fence->connProps[CONN_CRTC_ID], crtc);
+        ret |= drmAtomicAdd(req, crtc, cp[CRTC_MODE_ID], fence->modeBlob);
+        ret |= drmAtomicAdd(req, crtc, cp[CRTC_ACTIVE], 1);
+
+        if (output->vrr)
+            ret |= drmAtomicAdd(req, crtc, cp[CRTC_VRR_ENABLED], 1);
+    }
+
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_FB_ID], fbid);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_CRTC_ID], crtc);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_SRC_X], 0);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_SRC_Y], 0);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_SRC_W], kms->mode->hdisplay << 16);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_SRC_H], kms->mode->vdisplay << 16);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_CRTC_X], 0);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_CRTC_Y], 0);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_CRTC_W], kms->mode->hdisplay);
+    ret |= drmAtomicAdd(req, plane, pp[PLANE_CRTC_H], kms->mode->vdisplay);
+
+    if (inFence != -1)
+        ret |= drmAtomicAdd(req, plane, pp[PLANE_IN_FENCE_FD], inFence);
+
+    if (async)
+        flags |= DRM_MODE_PAGE_FLIP_ASYNC | DRM_MODE_PAGE_FLIP_EVENT;
+    else
+        ret |= drmAtomicAdd(req, crtc, cp[CRTC_OUT_FENCE_PTR], (uint64_t) (unsigned long) &fence->kmsFence);
+
+    if (!ret)
+        ret = drmModeAtomicCommit(fd, req, flags, output);
+
+    drmModeAtomicFree(req);
+    return ret;
+}
+
+/* take rendered frame from EGL: with fencing CPU does not wait for the GPU */
+
+static struct DrmFb * drmFrameSubmit(int fd, EGLDisplay dpy, struct DrmOutput *output, struct DrmFence *fence)
+{
+    EGLSyncKHR gpuSync = EGL_NO_SYNC_KHR;
+    struct gbm_bo *bo;
+    struct DrmFb *fb;
+    int gpuFence = -1;
+
+    if (fence->enabled) {
+        EGLint attribs[] = {
+            EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+            EGL_NONE
+        };
+
+        /* signalled when GPU is done with everything queued so far */
+        gpuSync = fence->createSync(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+    }
+
+    /* flushes rendering: native fence fd can be taken only after that */
+    eglSwapBuffers(dpy, output->eglSurface);
+
+    if (gpuSync != EGL_NO_SYNC_KHR) {
+        gpuFence = fence->dupNativeFenceFd(dpy, gpuSync);
+        fence->destroySync(dpy, gpuSync);
+    }
+
+    if (fence->enabled && gpuFence == -1) {
+        fprintf(stderr, "no gpu fence, wait for rendering\n");
+        glFinish();
+    }
+
+    bo = gbm_surface_lock_front_buffer(output->surface);
+    if (!bo) {
+        fprintf(stderr, "no gbm buffer object");
+        goto close_fence;
+    }
+
+    fb = drmFbGetFromBo(bo, fd, output);
+    if (!fb) {
+        gbm_surface_release_buffer(output->surface, bo);
+        goto close_fence;
+    }
+
+    fb->gpuFence = gpuFence;
+    output->locked++;
+    output->last = fb;
+
+    output->queue[(output->qhead + output->qcount) % MAXDEPTH] = fb;
+    output->qcount++;
+
+    return fb;
+
+close_fence:
+    if (gpuFence != -1)
+        close(gpuFence);
+
+    return NULL;
+}
+
+/* flip to the oldest queued frame unless a flip is already in flight */
+
+static int drmFrameKick(int fd, struct kms_display *kms, struct DrmOutput *output, struct DrmFence *fence)
+{
+    struct DrmFb *fb;
+    int ret;
+
+    if (output->next || !output->qcount)
+        return 0;
+
+    fb = output->queue[output->qhead];
+    output->qhead = (output->qhead + 1) % MAXDEPTH;
+    output->qcount--;
+
+    output->next = fb;
+
+    if (fence->enabled) {
+        ret = drmAtomicCommit(fd, kms, fence, fb->fbid, fb->gpuFence, !output->current, output);
+        if (ret && output->async && output->current) {
+            fprintf(stderr, "async commit rejected, fall back to vsync\n");
+            output->async = 0;
+            ret = drmAtomicCommit(fd, kms, fence, fb->fbid, fb->gpuFence, 0, output);
+        }
+
+        if (ret) {
+            perror("failed drmModeAtomicCommit");
+            return ret;
+        }
+
+        if (!output->current)
+            drm_report_first_modeset();
+    } else if (!output->current) {
+        ret = drmModeSetCrtc(fd, kms->crtc->crtc_id, fb->fbid, 0, 0,
+                &kms->connector->connector_id, 1, kms->mode);
+        if (ret) {
+            fprintf(stderr, "failed to set mode in swapBuffers");
+            return ret;
+        }
+
+        /* legacy modeset is synchronous */
+        drmFlipDone(output, 0, 0);
+        drm_report_first_modeset();
+    } else {
+        ret = drmModePageFlip(fd, kms->crtc->crtc_id, fb->fbid, DRM_MODE_PAGE_FLIP_EVENT |
+                (output->async ? DRM_MODE_PAGE_FLIP_ASYNC : 0), output);
+        if (ret < 0 && output->async) {
+            fprintf(stderr, "async flip rejected, fall back to vsync\n");
+            output->async = 0;
+            ret = drmModePageFlip(fd, kms->crtc->crtc_id, fb->fbid, DRM_MODE_PAGE_FLIP_EVENT, output);
+        }
+
+        if (ret < 0) {
+            fprintf(stderr, "queueing pageflip failed");
+            return ret;
+        }
+
+        output->pageFlipPending = 1;
+    }
+
+    return 0;
+}
+
+/* wait up to 'timeout' ms for the flip in flight, then kick the next one */
+
+static int drmFrameRetire(int fd, struct kms_display *kms, struct DrmOutput *output,
+        struct DrmFence *fence, int timeout)
+{
+    struct pollfd pfd;
+
+    if (!output->next)
+        return drmFrameKick(fd, kms, output, fence);
+
+    /* commits with OUT_FENCE_PTR complete on the fence, the rest with an event */
+
+    pfd.fd = fence->kmsFence != -1 ? fence->kmsFence : fd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, timeout) <= 0)
+        return 0;
+
+    if (pfd.fd == fence->kmsFence) {
+        struct timespec ts = { 0, 0 };
+
+        fenceTimestamp(fence->kmsFence, &ts);
+        close(fence->kmsFence);
+        fence->kmsFence = -1;
+        drmFlipDone(output, ts.tv_sec, ts.tv_nsec / 1000);
+    } else {
+        onDrmInput(fd);
+    }
+
+    return drmFrameKick(fd, kms, output, fence);
+}
+
+static void drmFenceFini(int fd, struct DrmFence *fence)
+{
+    if (!fence->enabled)
+        return;
+
+    if (fence->kmsFence != -1)
+        close(fence->kmsFence);
+
+    drmModeDestroyPropertyBlob(fd, fence->modeBlob);
+}
+
+static void usage(char *name)
+{
+    printf("usage: %s [-h] [-q] [-n <connector>] [-e <encoder>] [-c <crtc>] [-m <mode>] [-d <depth>] [-f <frames>] [-i] [-a] [-v] [-j <ms>] [-A <gl|gles>] [-s <stress>]\n", name);
+    printf("\t-h: this help message\n");
+    printf("\t-q: use current connector state, don't probe\n");
+    printf("\t-n, -e, -c, -m: connector, encoder, crtc ids and mode name, default is autoconfiguration\n");
+    printf("\t-d <depth>: frames in flight, 2 or 3, default is 2\n");
+    printf("\t-f <frames>: number of frames to render, default is 300\n");
+    printf("\t-i: wait for enter before every frame\n");
+    printf("\t-a: async flips, don't wait for vblank (tearing)\n");
+    printf("\t-v: variable refresh rate, if connector is vrr capable\n");
+    printf("\t-j <ms>: irregular content, up to <ms> of extra work per frame\n");
+    printf("\t-A <api>: client API, desktop GL or GLES 2/3, default is %s\n", gl_api_name());
+    printf("\t-s objects=N,layers=N,alu=N,texture=N: GPU stress scene instead of the triangle,\n");
+    printf("\t\tomitted keys use 1024 objects, 4 layers, 8 alu iterations, 1024 texture\n");
+}
+
 /* */
 
 int main(int argc, char *argv[])
@@ -161,15 +594,83 @@ int main(int argc, char *argv[])
     struct kms_display kms;
 
     struct DrmOutput output = { 0 };
+    struct DrmFence fence = { 0 };
 
     struct gbm_device *gbm;
 
+    struct drm_frame_stats stats = { 0 };
+    struct timespec start, ts, renderTs;
+    double total;
+
+    uint32_t nid = 0, eid = 0, cid = 0;
+    char *mode_name = NULL;
+    int frames = 300;
+    int jitter = 0;
+
+    struct gl_stress_params stressParams = GL_STRESS_DEFAULTS;
+    bool stressScene = false;
+    int step = 0;
+
     float angle = 0.0;
-    int ret, fd, i;
+    int ret, fd, i, opt;
 
-    struct timeval tv;
-    fd_set rset;
-    int len, max;
+    output.depth = 2;
+
+    while ((opt = getopt(argc, argv, "n:e:c:m:qd:f:iavj:A:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                nid = atoi(optarg);
+                break;
+            case 'e':
+                eid = atoi(optarg);
+                break;
+            case 'c':
+                cid = atoi(optarg);
+                break;
+            case 'm':
+                mode_name = optarg;
+                break;
+            case 'q':
+                drm_set_probe(false);
+                break;
+            case 'd':
+                output.depth = atoi(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'i':
+                step = 1;
+                break;
+            case 'a':
+                output.async = 1;
+                break;
+            case 'v':
+                output.vrr = 1;
+                break;
+            case 'j':
+                jitter = atoi(optarg);
+                break;
+            case 'A':
+                if (!gl_set_api(optarg))
+                    return -1;
+                break;
+            case 's':
+                if (!gl_stress_parse(&stressParams, optarg))
+                    return -1;
+                stressScene = true;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 0;
+        }
+    }
+
+    if (output.depth < 2 || output.depth > MAXDEPTH) {
+        fprintf(stderr, "frames in flight must be 2..%d\n", MAXDEPTH);
+        return -1;
+    }
 
     /* */
 
@@ -181,10 +682,7 @@ int main(int argc, char *argv[])
 
 	/* */
 
-    if (argc > 1)
-        ret = drm_get_conf_cmdline(fd, &kms, argc, argv);
-    else
-        ret = drm_autoconf(fd, &kms);
+    ret = drm_get_conf(fd, &kms, nid, eid, cid, mode_name);
 
     if (ret == false) {
         fprintf(stderr, "failed to setup KMS\n");
@@ -228,15 +726,13 @@ int main(int argc, char *argv[])
         goto egl_terminate;
     }
 
-    eglBindAPI(EGL_OPENGL_API);
-
-    static const EGLint configAttribs[] = {
+    const EGLint configAttribs[] = {
         EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
         EGL_RED_SIZE,   1,
         EGL_GREEN_SIZE, 1,
         EGL_BLUE_SIZE,  1,
         EGL_ALPHA_SIZE, 0,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RENDERABLE_TYPE, gl_renderable_type(),
         EGL_NONE
     };
 
@@ -247,12 +743,7 @@ int main(int argc, char *argv[])
         goto egl_terminate;
     }
 
-    EGLint contextAttrs[] = {
-        EGL_CONTEXT_CLIENT_VERSION, 2,
-        EGL_NONE
-    };
-
-    ctx = eglCreateContext(dpy, eglConfig, EGL_NO_CONTEXT, contextAttrs);
+    ctx = gl_context_create(dpy, eglConfig);
     if (!ctx)
     {
         fprintf(stderr, "failed to create context\n");
@@ -266,6 +757,14 @@ int main(int argc, char *argv[])
         goto destroy_context;
     }
 
+    /* shaders, buffers and fixed state are set up once for the whole run */
+
+    if (!gl_scene_init(stressScene ? &stressParams : NULL)) {
+        fprintf(stderr, "failed to set up renderer\n");
+        ret = -1;
+        goto unmake_current;
+    }
+
     /* */
 
     output.surface = gbm_surface_create(gbm,
@@ -287,7 +786,7 @@ int main(int argc, char *argv[])
     }
 
     if (!eglMakeCurrent(dpy, output.eglSurface, output.eglSurface, ctx)) {
-        fprintf(stderr, "failed to make eglSurface[%d] current\n", i);
+        fprintf(stderr, "failed to make eglSurface current\n");
         ret = -1;
         goto destroy_egl_surface;
     }
@@ -300,77 +799,113 @@ int main(int argc, char *argv[])
 
     dump_crtc_configuration("saved_crtc", saved_crtc);
 
+    /* fall back to glFinish and legacy page flips without explicit fencing */
+
+    if (drmFenceInit(fd, dpy, extensions, &kms, &fence))
+        printf("explicit fencing is not available\n");
+
+    if (output.async && !drm_async_flip_supported(fd, fence.enabled)) {
+        printf("async %s flips are not supported, use vsync\n", fence.enabled ? "atomic" : "legacy");
+        output.async = 0;
+    }
+
+    /* vrr is requested with the initial atomic modeset */
+
+    if (output.vrr && !fence.enabled) {
+        printf("variable refresh rate needs atomic modesetting, use fixed rate\n");
+        output.vrr = 0;
+    } else if (output.vrr && !drm_vrr_capable(fd, kms.connector->connector_id)) {
+        printf("connector %u is not vrr capable, use fixed rate\n", kms.connector->connector_id);
+        output.vrr = 0;
+    }
+
     /* */
 
-    for(i = 0; i < 10; i++){
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-        FD_ZERO(&rset);
-        FD_SET(fd, &rset);
+    for (i = 0; i < frames; i++) {
 
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
+        /* block only when all buffers are busy: on screen, flipping or queued */
 
-        ret = select(fd + 1, &rset, NULL, NULL,&tv);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
 
-        if(ret == -1) {
-            if(errno == EINTR) {
-                fprintf(stderr, "'select' was interrupted, try again");
-                continue;
-            } else {
-                perror("exit on select error");
+        while (output.locked >= output.depth || !gbm_surface_has_free_buffers(output.surface)) {
+            if (!output.next && !output.qcount) {
+                fprintf(stderr, "no free buffers and nothing to flip\n");
                 break;
             }
+
+            if (drmFrameRetire(fd, &kms, &output, &fence, 1000))
+                break;
         }
 
-        if (FD_ISSET(fd, &rset)){
-            fprintf(stdout, "process drm event\n");
-            onDrmInput(fd);
+        stats.blocked += drm_elapsed(&ts);
+
+        if (step) {
+            puts("press enter...");
+            getchar();
         }
 
+        /* GPU still busy with the previous frame: CPU work overlaps it */
+
+        if (output.last && fenceBusy(output.last->gpuFence))
+            stats.overlapped++;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
 
         fprintf(stdout, "render frame\n");
-        render_stuff(kms.mode->hdisplay, kms.mode->vdisplay, angle);
+
+        if (jitter)
+            usleep(rand() % (jitter * 1000));
+
+        clock_gettime(CLOCK_MONOTONIC, &renderTs);
+
+        gl_scene_frame(kms.mode->hdisplay, kms.mode->vdisplay, angle);
+        if (!fence.enabled)
+            glFinish();
+
+        drm_time_stats_add(&stats.render, drm_elapsed(&renderTs) * 1000.0);
+
         angle += 1.0;
 
-        puts("press enter...");
-        getchar();
+        if (!drmFrameSubmit(fd, dpy, &output, &fence))
+            break;
 
-        if (!output.next)
-        {
-            eglSwapBuffers(dpy, output.eglSurface);
-            struct gbm_bo *bo = gbm_surface_lock_front_buffer(output.surface);
-            if (!bo) {
-                fprintf(stderr, "no gbm buffer object");
-                break;
-            }
+        output.last->renderTs = ts;
 
-            output.next = drmFbGetFromBo(bo, fd, &output);
-            if (!output.next)
-            {
-                gbm_surface_release_buffer(output.surface, bo);
-                break;
-            }
-        }
+        stats.cpu_busy += drm_elapsed(&ts);
+        stats.inflight += output.locked - (output.current ? 1 : 0);
+        stats.frames++;
 
-        if (!output.current)
-        {
-            if (drmModeSetCrtc(fd, kms.crtc->crtc_id, output.next->fbid, 0, 0,
-                        &kms.connector->connector_id, 1, kms.mode))
-            {
-                fprintf(stderr, "failed to set mode in swapBuffers");
-                break;
-            }
-        }
+        if (drmFrameRetire(fd, &kms, &output, &fence, 0))
+            break;
+    }
 
-        if (drmModePageFlip(fd, kms.crtc->crtc_id, output.next->fbid, DRM_MODE_PAGE_FLIP_EVENT, &output) < 0)
-        {
-            fprintf(stderr, "queueing pageflip failed");
+    /* drain the pipeline */
+
+    while (output.next || output.qcount) {
+        struct DrmFb *pending = output.next;
+
+        if (drmFrameRetire(fd, &kms, &output, &fence, 1000) || (pending && output.next == pending))
             break;
-        }
+    }
+
+    total = drm_elapsed(&start);
 
-        output.pageFlipPending = 1;
+    if (stats.frames) {
+        drm_frame_stats_dump(&stats, total, output.depth, fence.enabled, gl_api_name());
+        gl_scene_report(stats.frames, total, kms.mode->hdisplay, kms.mode->vdisplay);
+
+        /* bounded by the refresh rate unless flips are async */
+        drm_time_stats_dump(&output.latency, output.async ? "render to scanout (async)" : "render to scanout (vsync)");
+        drm_time_stats_dump(&output.interval, output.vrr ? "frame interval (vrr)" : "frame interval (fixed)");
     }
 
+    if (output.vrr)
+        drm_vrr_enable(fd, kms.crtc->crtc_id, false);
+
+    drmFenceFini(fd, &fence);
+
     ret = drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
             saved_crtc->x, saved_crtc->y, &kms.connector->connector_id, 1, &saved_crtc->mode);
 
@@ -387,6 +922,7 @@ destroy_gbm_surface:
     gbm_surface_destroy(output.surface);
 
 unmake_current:
+    gl_scene_fini();
     eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 
 destroy_context:
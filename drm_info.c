@@ -23,6 +23,8 @@
  * OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -30,11 +32,19 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
 
 #include <drm.h>
 #include <drm_fourcc.h>
 #include <xf86drmMode.h>
 
+#include "drm_utils.h"
+#include "snapshot_utils.h"
+
 /* */
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -207,11 +217,383 @@ type_name_fn(format)
 
 /* */
 
+static const char device_dir[] = "/dev/dri";
 static const char device_name[] = "/dev/dri/card0";
 
+static bool probe = true;
+
 /* */
 
-void crtc_info(drmModeRes *resources, drmModeCrtc *crtc)
+void usage(char *name)
+{
+	printf("usage: %s [-h] [-q] [-j] [-b <file>] [-r <file>] [-p <count>] [-w <ms>] [-c] [-B <layout>] [-d <device>]\n", name);
+	printf("\t-h: this help message\n");
+	printf("\t-q: use current connector state, don't probe\n");
+	printf("\t-j: print topology snapshot as JSON instead of text\n");
+	printf("\t-b <file>: save binary topology snapshot to file\n");
+	printf("\t-r <file>: read binary snapshot from file instead of the device, print it as JSON\n");
+	printf("\t-p, --profile <count>: time every libdrm query over count repetitions\n");
+	printf("\t-w, --watch <ms>: print state changes, polled every ms and on hotplug, 0: hotplug only\n");
+	printf("\t-c, --caps: per crtc plane capabilities and current scanout bandwidth\n");
+	printf("\t-B, --bandwidth <WxH[:bpp][@hz],...>: scanout bandwidth of a proposed layout\n");
+	printf("\t-d <device>: query only this device, default: text dump of every %s/card*,\n", device_dir);
+	printf("\t\t%s for -j, -b, -p, -w and -c\n", device_name);
+}
+
+/* JSON rendering of a topology snapshot: one object, stable keys, no text parsing needed */
+
+static void json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char) *str);
+		else
+			fputc(*str, out);
+	}
+
+	fputc('"', out);
+}
+
+static void json_fourcc(FILE *out, uint32_t format)
+{
+	char name[5];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		name[i] = (format >> (8 * i)) & 0xff;
+		if (name[i] < 0x20 || name[i] > 0x7e)
+			name[i] = '?';
+	}
+	name[4] = '\0';
+
+	json_string(out, name);
+}
+
+static void json_mode(FILE *out, drmModeModeInfo *mode)
+{
+	char name[DRM_DISPLAY_MODE_LEN + 1];
+
+	memcpy(name, mode->name, DRM_DISPLAY_MODE_LEN);
+	name[DRM_DISPLAY_MODE_LEN] = '\0';
+
+	fprintf(out, "{\"name\": ");
+	json_string(out, name);
+	fprintf(out, ", \"clock\": %u, \"hdisplay\": %u, \"hsync_start\": %u, \"hsync_end\": %u, \"htotal\": %u, "
+		"\"vdisplay\": %u, \"vsync_start\": %u, \"vsync_end\": %u, \"vtotal\": %u, "
+		"\"vrefresh\": %u, \"flags\": %u, \"type\": %u}",
+		mode->clock, mode->hdisplay, mode->hsync_start, mode->hsync_end, mode->htotal,
+		mode->vdisplay, mode->vsync_start, mode->vsync_end, mode->vtotal,
+		mode->vrefresh, mode->flags, mode->type);
+}
+
+static void json_props(FILE *out, struct drm_snapshot *snap, struct drm_snap_list *list)
+{
+	struct drm_snap_prop *prop;
+	uint32_t i;
+
+	fprintf(out, "{");
+
+	for (i = 0; i < list->count; i++) {
+		prop = &snap->props[list->first + i];
+
+		fprintf(out, "%s", i ? ", " : "");
+		json_string(out, prop->name[0] ? prop->name : "(unknown)");
+		fprintf(out, ": {\"id\": %u, \"flags\": %u, \"value\": %llu}",
+			prop->prop_id, prop->flags, (unsigned long long) prop->value);
+	}
+
+	fprintf(out, "}");
+}
+
+static void json_ids(FILE *out, struct drm_snapshot *snap, struct drm_snap_list *list)
+{
+	uint32_t i;
+
+	fprintf(out, "[");
+	for (i = 0; i < list->count; i++)
+		fprintf(out, "%s%u", i ? ", " : "", snap->ids[list->first + i]);
+	fprintf(out, "]");
+}
+
+void snapshot_json(struct drm_snapshot *snap, FILE *out)
+{
+	struct drm_snapshot_header *header = snap->header;
+	struct drm_snap_connector *connector;
+	struct drm_snap_encoder *encoder;
+	struct drm_snap_plane *plane;
+	struct drm_snap_crtc *crtc;
+	struct drm_snap_fb *fb;
+	uint32_t i, j;
+
+	fprintf(out, "{\n\"version\": %u,\n\"probe\": %s,\n", header->version, header->probe ? "true" : "false");
+	fprintf(out, "\"min_width\": %u, \"max_width\": %u, \"min_height\": %u, \"max_height\": %u,\n",
+		header->min_width, header->max_width, header->min_height, header->max_height);
+
+	fprintf(out, "\"crtcs\": [");
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_CRTCS); i++) {
+		crtc = &snap->crtcs[i];
+
+		fprintf(out, "%s\n  {\"id\": %u, \"fb\": %u, \"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u, "
+			"\"gamma_size\": %u, \"mode\": ", i ? "," : "",
+			crtc->crtc_id, crtc->buffer_id, crtc->x, crtc->y, crtc->width, crtc->height, crtc->gamma_size);
+
+		if (crtc->mode_valid)
+			json_mode(out, &crtc->mode);
+		else
+			fprintf(out, "null");
+
+		fprintf(out, ", \"props\": ");
+		json_props(out, snap, &crtc->props);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n],\n");
+
+	fprintf(out, "\"connectors\": [");
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_CONNECTORS); i++) {
+		connector = &snap->connectors[i];
+
+		fprintf(out, "%s\n  {\"id\": %u, \"type\": ", i ? "," : "", connector->connector_id);
+		json_string(out, connector_type_str(connector->connector_type));
+		fprintf(out, ", \"type_id\": %u, \"status\": ", connector->connector_type_id);
+		json_string(out, connector_status_str(connector->connection));
+		fprintf(out, ", \"encoder\": %u, \"mm_width\": %u, \"mm_height\": %u, \"subpixel\": %u, \"encoders\": ",
+			connector->encoder_id, connector->mm_width, connector->mm_height, connector->subpixel);
+		json_ids(out, snap, &connector->encoders);
+
+		fprintf(out, ", \"modes\": [");
+		for (j = 0; j < connector->modes.count; j++) {
+			fprintf(out, "%s\n    ", j ? "," : "");
+			json_mode(out, &snap->modes[connector->modes.first + j]);
+		}
+
+		fprintf(out, "], \"props\": ");
+		json_props(out, snap, &connector->props);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n],\n");
+
+	fprintf(out, "\"encoders\": [");
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_ENCODERS); i++) {
+		encoder = &snap->encoders[i];
+
+		fprintf(out, "%s\n  {\"id\": %u, \"type\": ", i ? "," : "", encoder->encoder_id);
+		json_string(out, encoder_type_str(encoder->encoder_type));
+		fprintf(out, ", \"crtc\": %u, \"possible_crtcs\": %u, \"possible_clones\": %u}",
+			encoder->crtc_id, encoder->possible_crtcs, encoder->possible_clones);
+	}
+	fprintf(out, "\n],\n");
+
+	fprintf(out, "\"planes\": [");
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_PLANES); i++) {
+		plane = &snap->planes[i];
+
+		fprintf(out, "%s\n  {\"id\": %u, \"crtc\": %u, \"fb\": %u, \"crtc_x\": %u, \"crtc_y\": %u, "
+			"\"x\": %u, \"y\": %u, \"possible_crtcs\": %u, \"gamma_size\": %u, \"formats\": [",
+			i ? "," : "", plane->plane_id, plane->crtc_id, plane->fb_id, plane->crtc_x, plane->crtc_y,
+			plane->x, plane->y, plane->possible_crtcs, plane->gamma_size);
+
+		for (j = 0; j < plane->formats.count; j++) {
+			fprintf(out, "%s", j ? ", " : "");
+			json_fourcc(out, snap->ids[plane->formats.first + j]);
+		}
+
+		fprintf(out, "], \"props\": ");
+		json_props(out, snap, &plane->props);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n],\n");
+
+	fprintf(out, "\"fbs\": [");
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_FBS); i++) {
+		fb = &snap->fbs[i];
+
+		fprintf(out, "%s\n  {\"id\": %u, \"width\": %u, \"height\": %u, \"format\": ",
+			i ? "," : "", fb->fb_id, fb->width, fb->height);
+
+		if (fb->pixel_format)
+			json_fourcc(out, fb->pixel_format);
+		else
+			fprintf(out, "null");
+
+		fprintf(out, ", \"modifier\": %llu, \"bpp\": %u, \"depth\": %u, \"pitches\": [%u, %u, %u, %u]}",
+			(unsigned long long) fb->modifier, fb->bpp, fb->depth,
+			fb->pitches[0], fb->pitches[1], fb->pitches[2], fb->pitches[3]);
+	}
+	fprintf(out, "\n]\n}\n");
+}
+
+/* properties: metadata comes from the cache, values from the object */
+
+static bool prop_is(drmModePropertyRes *prop, uint32_t type)
+{
+	if (prop->flags & DRM_MODE_PROP_EXTENDED_TYPE)
+		return (prop->flags & DRM_MODE_PROP_EXTENDED_TYPE) == type;
+
+	return (prop->flags & type) != 0;
+}
+
+static void modifier_info(FILE *out, uint64_t modifier)
+{
+	if (modifier == 0)
+		fprintf(out, "LINEAR");
+	else if (modifier == 0x00ffffffffffffffULL)
+		fprintf(out, "INVALID");
+	else
+		fprintf(out, "vendor 0x%02x:0x%014llx", (unsigned) (modifier >> 56),
+			(unsigned long long) (modifier & 0x00ffffffffffffffULL));
+}
+
+/* IN_FORMATS: every format with the modifiers it can be scanned out with */
+
+static void in_formats_info(FILE *out, int fd, uint32_t blob_id)
+{
+	struct drm_format_modifier_blob *header;
+	struct drm_format_modifier *modifiers;
+	drmModePropertyBlobRes *blob;
+	uint32_t *formats;
+	uint32_t i, j;
+	bool first;
+
+	blob = drmModeGetPropertyBlob(fd, blob_id);
+	if (!blob)
+		return;
+
+	header = blob->data;
+
+	if (blob->length < sizeof(*header) ||
+			header->formats_offset + (uint64_t) header->count_formats * sizeof(uint32_t) > blob->length ||
+			header->modifiers_offset + (uint64_t) header->count_modifiers * sizeof(*modifiers) > blob->length) {
+		fprintf(out, "\t\t\tmalformed blob\n");
+		goto out;
+	}
+
+	formats = (uint32_t *) ((char *) blob->data + header->formats_offset);
+	modifiers = (struct drm_format_modifier *) ((char *) blob->data + header->modifiers_offset);
+
+	for (i = 0; i < header->count_formats; i++) {
+		fprintf(out, "\t\t\t%s:", format_str(formats[i]));
+		first = true;
+
+		/* modifier applies to 64 formats starting at offset, one bit each */
+		for (j = 0; j < header->count_modifiers; j++) {
+			if (i < modifiers[j].offset || i >= modifiers[j].offset + 64 ||
+					!(modifiers[j].formats & (1ULL << (i - modifiers[j].offset))))
+				continue;
+
+			fprintf(out, "%s", first ? " " : ", ");
+			modifier_info(out, modifiers[j].modifier);
+			first = false;
+		}
+
+		fprintf(out, "\n");
+	}
+
+out:
+	drmModeFreePropertyBlob(blob);
+}
+
+static void prop_value_info(FILE *out, int fd, drmModePropertyRes *prop, uint64_t value)
+{
+	drmModePropertyBlobRes *blob;
+	bool first = true;
+	int i;
+
+	if (prop_is(prop, DRM_MODE_PROP_ENUM)) {
+		for (i = 0; i < prop->count_enums; i++) {
+			if (prop->enums[i].value == value)
+				fprintf(out, "%s", prop->enums[i].name);
+		}
+
+		fprintf(out, " [");
+		for (i = 0; i < prop->count_enums; i++)
+			fprintf(out, "%s%s", i ? ", " : "", prop->enums[i].name);
+		fprintf(out, "]\n");
+
+	} else if (prop_is(prop, DRM_MODE_PROP_BITMASK)) {
+		for (i = 0; i < prop->count_enums; i++) {
+			if (prop->enums[i].value < 64 && (value & (1ULL << prop->enums[i].value))) {
+				fprintf(out, "%s%s", first ? "" : " | ", prop->enums[i].name);
+				first = false;
+			}
+		}
+
+		fprintf(out, "%s [", first ? "(none)" : "");
+		for (i = 0; i < prop->count_enums; i++)
+			fprintf(out, "%s%s", i ? ", " : "", prop->enums[i].name);
+		fprintf(out, "]\n");
+
+	} else if (prop_is(prop, DRM_MODE_PROP_RANGE)) {
+		fprintf(out, "%llu", (unsigned long long) value);
+		if (prop->count_values == 2)
+			fprintf(out, " [%llu, %llu]", (unsigned long long) prop->values[0], (unsigned long long) prop->values[1]);
+		fprintf(out, "\n");
+
+	} else if (prop_is(prop, DRM_MODE_PROP_SIGNED_RANGE)) {
+		fprintf(out, "%lld", (long long) value);
+		if (prop->count_values == 2)
+			fprintf(out, " [%lld, %lld]", (long long) prop->values[0], (long long) prop->values[1]);
+		fprintf(out, "\n");
+
+	} else if (prop_is(prop, DRM_MODE_PROP_OBJECT)) {
+		fprintf(out, "object %llu\n", (unsigned long long) value);
+
+	} else if (prop_is(prop, DRM_MODE_PROP_BLOB)) {
+		if (!value) {
+			fprintf(out, "blob 0\n");
+			return;
+		}
+
+		blob = drmModeGetPropertyBlob(fd, value);
+		fprintf(out, "blob %llu, %u bytes\n", (unsigned long long) value, blob ? blob->length : 0);
+
+		if (blob && !strcmp(prop->name, "MODE_ID") && blob->length >= sizeof(drmModeModeInfo))
+			fprintf(out, "\t\t\tmode %s\n", ((drmModeModeInfo *) blob->data)->name);
+
+		if (blob)
+			drmModeFreePropertyBlob(blob);
+
+		if (!strcmp(prop->name, "IN_FORMATS"))
+			in_formats_info(out, fd, value);
+
+	} else {
+		fprintf(out, "%llu\n", (unsigned long long) value);
+	}
+}
+
+void props_info(FILE *out, int fd, uint32_t obj_id, uint32_t obj_type)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props || !props->count_props) {
+		drmModeFreeObjectProperties(props);
+		return;
+	}
+
+	fprintf(out, "\tproperties:\n");
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drm_prop_get(fd, props->props[i]);
+		if (!prop) {
+			fprintf(out, "\t\t[%u]: %llu\n", props->props[i], (unsigned long long) props->prop_values[i]);
+			continue;
+		}
+
+		fprintf(out, "\t\t%s [%u]%s: ", prop->name, prop->prop_id,
+			prop->flags & DRM_MODE_PROP_IMMUTABLE ? " immutable" : "");
+		prop_value_info(out, fd, prop, props->prop_values[i]);
+	}
+
+	drmModeFreeObjectProperties(props);
+}
+
+void crtc_info(FILE *out, drmModeRes *resources, drmModeCrtc *crtc)
 {
 	/* From xf86drmMode.h:
 
@@ -230,16 +612,16 @@ void crtc_info(drmModeRes *resources, drmModeCrtc *crtc)
 
 	*/
 
-	printf("\ncrtc [id = %u]\n", crtc->crtc_id);
-	printf("\tbuffer [id = %u]\n", crtc->buffer_id);
-	printf("\tposition: %ux%u @ %ux%u\n", crtc->width, crtc->height, crtc->x, crtc->y);
+	fprintf(out, "\ncrtc [id = %u]\n", crtc->crtc_id);
+	fprintf(out, "\tbuffer [id = %u]\n", crtc->buffer_id);
+	fprintf(out, "\tposition: %ux%u @ %ux%u\n", crtc->width, crtc->height, crtc->x, crtc->y);
 	if (crtc->mode_valid)
-		printf("\tMode: valid [%s]\n", crtc->mode.name);
+		fprintf(out, "\tMode: valid [%s]\n", crtc->mode.name);
 	else
-		printf("\tMode: invalid\n");
+		fprintf(out, "\tMode: invalid\n");
 }
 
-void connector_info(drmModeRes *resources, drmModeConnector *connector)
+void connector_info(FILE *out, drmModeRes *resources, drmModeConnector *connector)
 {
 	drmModeModeInfo *mode;
 
@@ -270,15 +652,15 @@ void connector_info(drmModeRes *resources, drmModeConnector *connector)
 
 	*/
 
-	printf("\nConnector [id = %u]\n", connector->connector_id);
-	printf("\ttype [%s]\n", connector_type_str(connector->connector_type));
-	printf("\tstatus [%s]\n", connector_status_str(connector->connection));
+	fprintf(out, "\nConnector [id = %u]\n", connector->connector_id);
+	fprintf(out, "\ttype [%s]\n", connector_type_str(connector->connector_type));
+	fprintf(out, "\tstatus [%s]\n", connector_status_str(connector->connection));
 
 	for(i = 0, enc = connector->encoders; i < connector->count_encoders; i++, enc++) {
-		printf("%s[%u]%s", i ? " " : "\tsupported encoders: ", *enc, i == connector->count_encoders - 1 ? "\n" : " ");
+		fprintf(out, "%s[%u]%s", i ? " " : "\tsupported encoders: ", *enc, i == connector->count_encoders - 1 ? "\n" : " ");
 	}
 
-	printf("\tcurrent encoder: %u\n", connector->encoder_id);
+	fprintf(out, "\tcurrent encoder: %u\n", connector->encoder_id);
 
 	/* From xf86drmMode.h:
 
@@ -297,13 +679,13 @@ void connector_info(drmModeRes *resources, drmModeConnector *connector)
 	*/
 
 	for (i = 0, mode = connector->modes; i < connector->count_modes; i++, mode++) {
-		printf("%s[%s]%s", i ? " " : "\tmodes: ", mode->name, i == connector->count_modes - 1 ? "\n" : " ");
+		fprintf(out, "%s[%s]%s", i ? " " : "\tmodes: ", mode->name, i == connector->count_modes - 1 ? "\n" : " ");
     }
 
 	return;
 }
 
-void encoder_info(drmModeRes *resources, drmModeEncoder *encoder, drmModeCrtc **crtcs)
+void encoder_info(FILE *out, drmModeRes *resources, drmModeEncoder *encoder, drmModeCrtc **crtcs)
 {
 	int i;
 
@@ -319,24 +701,24 @@ void encoder_info(drmModeRes *resources, drmModeEncoder *encoder, drmModeCrtc **
 
 	*/
 
-	printf("\nEncoder [id = %u]\n", encoder->encoder_id);
-	printf("\ttype [%s]\n", encoder_type_str(encoder->encoder_type));
-	printf("\tCrtc [id = %u]\n", encoder->crtc_id);
+	fprintf(out, "\nEncoder [id = %u]\n", encoder->encoder_id);
+	fprintf(out, "\ttype [%s]\n", encoder_type_str(encoder->encoder_type));
+	fprintf(out, "\tCrtc [id = %u]\n", encoder->crtc_id);
 
-	printf("\tSupported crtc:");
+	fprintf(out, "\tSupported crtc:");
 	for (i = 0; i < 31; i++)
 		if (encoder->possible_crtcs & (1 << i)) {
 			if (crtcs[i] != NULL)
-				printf(" [id = %d]", crtcs[i]->crtc_id);
+				fprintf(out, " [id = %d]", crtcs[i]->crtc_id);
 			else
-				printf(" [#%d, ??]",  i);
+				fprintf(out, " [#%d, ??]",  i);
 		}
-	printf("\n");
+	fprintf(out, "\n");
 
 	return;
 }
 
-void fb_info(drmModeRes *resources, drmModeFB *fb)
+void fb_info(FILE *out, drmModeRes *resources, drmModeFB *fb)
 {
 	/* From xf86drmMode.h:
 
@@ -350,13 +732,13 @@ void fb_info(drmModeRes *resources, drmModeFB *fb)
 	} drmModeFB, *drmModeFBPtr;
 	*/
 
-	printf("\nFramebuffer [id = %u]\n", fb->fb_id);
-	printf("\tdimenstions: %ux%u\n", fb->width, fb->height);
-	printf("\tbpp: %u\n", fb->bpp);
-	printf("\tdepth: %u\n", fb->depth);
+	fprintf(out, "\nFramebuffer [id = %u]\n", fb->fb_id);
+	fprintf(out, "\tdimenstions: %ux%u\n", fb->width, fb->height);
+	fprintf(out, "\tbpp: %u\n", fb->bpp);
+	fprintf(out, "\tdepth: %u\n", fb->depth);
 }
 
-void fb2_info(drmModeRes *resources, drmModeFB2 *fb2)
+void fb2_info(FILE *out, drmModeRes *resources, drmModeFB2 *fb2)
 {
 	/* From xf86drmMode.h:
 
@@ -373,12 +755,12 @@ void fb2_info(drmModeRes *resources, drmModeFB2 *fb2)
 	} drmModeFB2, *drmModeFB2Ptr;
 	*/
 
-	printf("\nFramebuffer [id = %u]\n", fb2->fb_id);
-	printf("\tdimenstions: %ux%u\n", fb2->width, fb2->height);
-	printf("\tpixel format: %s\n", format_str(fb2->pixel_format));
+	fprintf(out, "\nFramebuffer [id = %u]\n", fb2->fb_id);
+	fprintf(out, "\tdimenstions: %ux%u\n", fb2->width, fb2->height);
+	fprintf(out, "\tpixel format: %s\n", format_str(fb2->pixel_format));
 }
 
-void plane_info(drmModePlane *plane, drmModeCrtc **crtcs)
+void plane_info(FILE *out, drmModePlane *plane, drmModeCrtc **crtcs)
 {
 	int i;
 
@@ -399,28 +781,28 @@ void plane_info(drmModePlane *plane, drmModeCrtc **crtcs)
 		uint32_t gamma_size;
 	} drmModePlane, *drmModePlanePtr;
 	*/
-	printf("\nPlane [id = %u]\n", plane->plane_id);
-	printf("\tFB ID [id = %u]\n", plane->fb_id);
-	printf("\tcrtc ID [id = %u]\n", plane->crtc_id);
+	fprintf(out, "\nPlane [id = %u]\n", plane->plane_id);
+	fprintf(out, "\tFB ID [id = %u]\n", plane->fb_id);
+	fprintf(out, "\tcrtc ID [id = %u]\n", plane->crtc_id);
 
 	for (i = 0; i < plane->count_formats; i++)
-		printf("%s '%s'", i == 0 ? "\tFormats:" : ",", format_str(plane->formats[i]));
-	printf("\n");
+		fprintf(out, "%s '%s'", i == 0 ? "\tFormats:" : ",", format_str(plane->formats[i]));
+	fprintf(out, "\n");
 
-	printf("\tCRTC XxY %ux%u\n", plane->crtc_x, plane->crtc_y);
-	printf("\tXxY %ux%u\n", plane->x, plane->y);
-	printf("\tSupported crtc:");
+	fprintf(out, "\tCRTC XxY %ux%u\n", plane->crtc_x, plane->crtc_y);
+	fprintf(out, "\tXxY %ux%u\n", plane->x, plane->y);
+	fprintf(out, "\tSupported crtc:");
 	for (i = 0; i < 31; i++)
 		if (plane->possible_crtcs & (1 << i)) {
 			if (crtcs[i] != NULL)
-				printf(" [id = %d]", crtcs[i]->crtc_id);
+				fprintf(out, " [id = %d]", crtcs[i]->crtc_id);
 			else
-				printf(" [#%d, ??]",  i);
+				fprintf(out, " [#%d, ??]",  i);
 		}
-	printf("\n");
+	fprintf(out, "\n");
 }
 
-void planes_info(int fd, drmModeCrtc **crtcs)
+void planes_info(FILE *out, int fd, drmModeCrtc **crtcs)
 {
 	drmModePlaneRes *plane_resources;
 	int i;
@@ -436,13 +818,18 @@ void planes_info(int fd, drmModeCrtc **crtcs)
 		if (!plane)
 			continue;
 
-		plane_info(plane, crtcs);
+		plane_info(out, plane, crtcs);
+		props_info(out, fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
 
 		drmModeFreePlane(plane);
 	}
+
+	drmModeFreePlaneResources(plane_resources);
 }
 
-int main(int argc, char *argv[])
+/* text dump of one device */
+
+int device_info(int fd, FILE *out)
 {
     drmModeCrtcPtr *crtcs;
     drmModeConnector *connector;
@@ -451,14 +838,13 @@ int main(int argc, char *argv[])
 	drmModeFB *fb;
 	drmModeFB2 *fb2;
 
-    int i, fd, ret;
+	struct timespec start, end;
+	int i;
+
+	/* all planes and atomic-only properties (zpos, IN_FORMATS, VRR_ENABLED...) */
 
-    fd = open(device_name, O_RDWR);
-    if (fd < 0) {
-        fprintf(stderr, "couldn't open %s, skipping\n", device_name);
-		ret = -1;
-		goto exit;
-    }
+	drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+	drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
 
 	/* From xf86drmMode.h:
 
@@ -485,8 +871,7 @@ int main(int argc, char *argv[])
     resources = drmModeGetResources(fd);
     if (!resources) {
         fprintf(stderr, "drmModeGetResources failed\n");
-		ret = -1;
-		goto close_fd;
+		return -1;
     }
 
 
@@ -496,25 +881,36 @@ int main(int argc, char *argv[])
         if (crtcs[i] == NULL)
             continue;
 
-		crtc_info(resources, crtcs[i]);
+		crtc_info(out, resources, crtcs[i]);
+		props_info(out, fd, crtcs[i]->crtc_id, DRM_MODE_OBJECT_CRTC);
     }
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
     for (i = 0; i < resources->count_connectors; i++) {
-        connector = drmModeGetConnector(fd, resources->connectors[i]);
+        connector = drm_get_connector(fd, resources->connectors[i]);
         if (connector == NULL)
             continue;
 
-		connector_info(resources, connector);
+		connector_info(out, resources, connector);
+		props_info(out, fd, connector->connector_id, DRM_MODE_OBJECT_CONNECTOR);
         drmModeFreeConnector(connector);
     }
 
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(out, "\nconnector query: %.1f ms (%s)\n",
+		(end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0,
+		probe ? "full probe" : "current state");
+
 	for (i = 0; i < resources->count_encoders; i++) {
         encoder = drmModeGetEncoder(fd, resources->encoders[i]);
 
         if (encoder == NULL)
             continue;
 
-		encoder_info(resources, encoder, crtcs);
+		encoder_info(out, resources, encoder, crtcs);
+		props_info(out, fd, encoder->encoder_id, DRM_MODE_OBJECT_ENCODER);
         drmModeFreeEncoder(encoder);
     }
 
@@ -524,28 +920,1014 @@ int main(int argc, char *argv[])
 
         fb2 = drmModeGetFB2(fd, crtcs[i]->buffer_id);
         if (fb2 != NULL) {
-			fb2_info(resources, fb2);
+			fb2_info(out, resources, fb2);
 			drmModeFreeFB2(fb2);
 		} else {
 			fb = drmModeGetFB(fd, crtcs[i]->buffer_id);
 			if (fb == NULL)
 				continue;
-			fb_info(resources, fb);
+			fb_info(out, resources, fb);
 			drmModeFreeFB(fb);
 		}
     }
 
-	planes_info(fd, crtcs);
+	planes_info(out, fd, crtcs);
 
 	for (i = 0; i < resources->count_crtcs; i++) {
 		if (crtcs[i] != NULL)
 			drmModeFreeCrtc(crtcs[i]);
 	}
 	free(crtcs);
+	drmModeFreeResources(resources);
+
+	return 0;
+}
+
+/* profile: each query repeated, min/median/max per object, nothing else printed */
+
+#define profile_call(samples, reps, obj, expr, free_fn) do {	\
+	struct timespec t0, t1;					\
+	int k;							\
+	for (k = 0; k < (reps); k++) {				\
+		clock_gettime(CLOCK_MONOTONIC, &t0);		\
+		obj = (expr);					\
+		clock_gettime(CLOCK_MONOTONIC, &t1);		\
+		(samples)[k] = (t1.tv_sec - t0.tv_sec) * 1000.0 +	\
+			(t1.tv_nsec - t0.tv_nsec) / 1000000.0;	\
+		if (obj)					\
+			free_fn(obj);				\
+	}							\
+} while (0)
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void profile_report(const char *call, uint32_t id, double *samples, int reps)
+{
+	char label[64];
+
+	qsort(samples, reps, sizeof(*samples), cmp_double);
+
+	if (id)
+		snprintf(label, sizeof(label), "%s %u", call, id);
+	else
+		snprintf(label, sizeof(label), "%s", call);
+
+	printf("  %-32s %9.3f %9.3f %9.3f\n", label,
+		samples[0], samples[reps / 2], samples[reps - 1]);
+}
+
+int profile_run(int fd, int reps)
+{
+	drmModePlaneRes *plane_resources;
+	drmModeConnector *connector;
+	drmModeEncoder *encoder;
+	drmModeRes *resources;
+	drmModePlane *plane;
+	drmModeCrtc *crtc;
+	drmModeFB2 *fb2;
+	double *samples;
+	uint32_t i;
+
+	samples = calloc(reps, sizeof(*samples));
+	if (!samples)
+		return -1;
+
+	drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+	printf("%d repetitions, ms:\n", reps);
+	printf("  %-32s %9s %9s %9s\n", "call", "min", "median", "max");
+
+	profile_call(samples, reps, resources, drmModeGetResources(fd), drmModeFreeResources);
+	profile_report("GetResources", 0, samples, reps);
+
+	resources = drmModeGetResources(fd);
+	if (!resources) {
+		fprintf(stderr, "drmModeGetResources failed\n");
+		free(samples);
+		return -1;
+	}
+
+	for (i = 0; i < (uint32_t) resources->count_crtcs; i++) {
+		profile_call(samples, reps, crtc, drmModeGetCrtc(fd, resources->crtcs[i]), drmModeFreeCrtc);
+		profile_report("GetCrtc", resources->crtcs[i], samples, reps);
+	}
+
+	for (i = 0; i < (uint32_t) resources->count_connectors; i++) {
+		profile_call(samples, reps, connector, drmModeGetConnector(fd, resources->connectors[i]), drmModeFreeConnector);
+		profile_report("GetConnector (probe)", resources->connectors[i], samples, reps);
+
+		profile_call(samples, reps, connector, drmModeGetConnectorCurrent(fd, resources->connectors[i]), drmModeFreeConnector);
+		profile_report("GetConnectorCurrent", resources->connectors[i], samples, reps);
+	}
+
+	for (i = 0; i < (uint32_t) resources->count_encoders; i++) {
+		profile_call(samples, reps, encoder, drmModeGetEncoder(fd, resources->encoders[i]), drmModeFreeEncoder);
+		profile_report("GetEncoder", resources->encoders[i], samples, reps);
+	}
+
+	/* framebuffers scanned out right now */
+
+	for (i = 0; i < (uint32_t) resources->count_crtcs; i++) {
+		crtc = drmModeGetCrtc(fd, resources->crtcs[i]);
+		if (!crtc)
+			continue;
+
+		if (crtc->buffer_id) {
+			profile_call(samples, reps, fb2, drmModeGetFB2(fd, crtc->buffer_id), drmModeFreeFB2);
+			profile_report("GetFB2", crtc->buffer_id, samples, reps);
+		}
+
+		drmModeFreeCrtc(crtc);
+	}
+
+	plane_resources = drmModeGetPlaneResources(fd);
+	if (plane_resources) {
+		for (i = 0; i < plane_resources->count_planes; i++) {
+			profile_call(samples, reps, plane, drmModeGetPlane(fd, plane_resources->planes[i]), drmModeFreePlane);
+			profile_report("GetPlane", plane_resources->planes[i], samples, reps);
+		}
+
+		drmModeFreePlaneResources(plane_resources);
+	}
+
+	drmModeFreeResources(resources);
+	free(samples);
+
+	return 0;
+}
+
+/* plane capability matrix per crtc, and scanout bandwidth: bytes fetched per
+ * second by every enabled plane, the number that has to fit the memory budget
+ * of the display engine to avoid underruns
+ */
+
+static int format_bpp(uint32_t format)
+{
+	switch (format) {
+	case DRM_FORMAT_C8:
+	case DRM_FORMAT_R8:
+	case DRM_FORMAT_RGB332:
+	case DRM_FORMAT_BGR233:
+		return 8;
+	case DRM_FORMAT_NV12:
+	case DRM_FORMAT_NV21:
+	case DRM_FORMAT_YUV420:
+	case DRM_FORMAT_YVU420:
+	case DRM_FORMAT_YUV420_8BIT:
+		return 12;
+	case DRM_FORMAT_R16:
+	case DRM_FORMAT_RG88:
+	case DRM_FORMAT_GR88:
+	case DRM_FORMAT_XRGB4444: case DRM_FORMAT_XBGR4444:
+	case DRM_FORMAT_RGBX4444: case DRM_FORMAT_BGRX4444:
+	case DRM_FORMAT_ARGB4444: case DRM_FORMAT_ABGR4444:
+	case DRM_FORMAT_RGBA4444: case DRM_FORMAT_BGRA4444:
+	case DRM_FORMAT_XRGB1555: case DRM_FORMAT_XBGR1555:
+	case DRM_FORMAT_RGBX5551: case DRM_FORMAT_BGRX5551:
+	case DRM_FORMAT_ARGB1555: case DRM_FORMAT_ABGR1555:
+	case DRM_FORMAT_RGBA5551: case DRM_FORMAT_BGRA5551:
+	case DRM_FORMAT_RGB565: case DRM_FORMAT_BGR565:
+	case DRM_FORMAT_YUYV: case DRM_FORMAT_YVYU:
+	case DRM_FORMAT_UYVY: case DRM_FORMAT_VYUY:
+	case DRM_FORMAT_NV16: case DRM_FORMAT_NV61:
+	case DRM_FORMAT_YUV422: case DRM_FORMAT_YVU422:
+		return 16;
+	case DRM_FORMAT_RGB888:
+	case DRM_FORMAT_BGR888:
+	case DRM_FORMAT_VUY888:
+	case DRM_FORMAT_NV24: case DRM_FORMAT_NV42:
+	case DRM_FORMAT_YUV444: case DRM_FORMAT_YVU444:
+	case DRM_FORMAT_P010: case DRM_FORMAT_P012: case DRM_FORMAT_P016:
+		return 24;
+	case DRM_FORMAT_XRGB16161616F: case DRM_FORMAT_XBGR16161616F:
+	case DRM_FORMAT_ARGB16161616F: case DRM_FORMAT_ABGR16161616F:
+	case DRM_FORMAT_Y412: case DRM_FORMAT_Y416:
+	case DRM_FORMAT_XVYU12_16161616: case DRM_FORMAT_XVYU16161616:
+		return 64;
+	default:
+		return 32;
+	}
+}
+
+static double mode_refresh(drmModeModeInfo *mode)
+{
+	if (mode->htotal && mode->vtotal)
+		return mode->clock * 1000.0 / (mode->htotal * mode->vtotal);
+
+	return mode->vrefresh;
+}
+
+/* bytes per second, in MB/s */
+
+static double layer_bandwidth(uint32_t width, uint32_t height, int bpp, double refresh)
+{
+	return (double) width * height * bpp / 8 * refresh / 1000000.0;
+}
+
+static struct drm_snap_prop * snap_prop(struct drm_snapshot *snap, struct drm_snap_list *list, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < list->count; i++) {
+		if (!strcmp(snap->props[list->first + i].name, name))
+			return &snap->props[list->first + i];
+	}
+
+	return NULL;
+}
+
+static const char * prop_enum_name(int fd, struct drm_snap_prop *sp)
+{
+	drmModePropertyRes *prop;
+	int i;
+
+	prop = sp ? drm_prop_get(fd, sp->prop_id) : NULL;
+	if (!prop)
+		return NULL;
+
+	for (i = 0; i < prop->count_enums; i++) {
+		if (prop->enums[i].value == sp->value)
+			return prop->enums[i].name;
+	}
+
+	return NULL;
+}
+
+static void prop_enum_list(FILE *out, int fd, struct drm_snap_prop *sp)
+{
+	drmModePropertyRes *prop;
+	int i;
+
+	prop = drm_prop_get(fd, sp->prop_id);
+	for (i = 0; prop && i < prop->count_enums; i++)
+		fprintf(out, "%s%s", i ? ", " : "", prop->enums[i].name);
+}
+
+/* distinct modifiers advertised in IN_FORMATS, plain formats list for old kernels */
+
+static void plane_modifiers(FILE *out, int fd, struct drm_snapshot *snap, struct drm_snap_plane *plane)
+{
+	struct drm_format_modifier_blob *header;
+	struct drm_format_modifier *modifiers;
+	drmModePropertyBlobRes *blob;
+	struct drm_snap_prop *sp;
+	uint32_t i, j;
+
+	sp = snap_prop(snap, &plane->props, "IN_FORMATS");
+	blob = sp && sp->value ? drmModeGetPropertyBlob(fd, sp->value) : NULL;
+	if (!blob) {
+		fprintf(out, "LINEAR (implicit)");
+		return;
+	}
+
+	header = blob->data;
+	if (blob->length < sizeof(*header) ||
+			header->modifiers_offset + (uint64_t) header->count_modifiers * sizeof(*modifiers) > blob->length) {
+		fprintf(out, "(malformed IN_FORMATS)");
+		goto out;
+	}
+
+	modifiers = (struct drm_format_modifier *) ((char *) blob->data + header->modifiers_offset);
+
+	for (i = 0; i < header->count_modifiers; i++) {
+		for (j = 0; j < i; j++) {
+			if (modifiers[j].modifier == modifiers[i].modifier)
+				break;
+		}
+
+		if (j < i)
+			continue;
+
+		fprintf(out, "%s", i ? ", " : "");
+		modifier_info(out, modifiers[i].modifier);
+	}
+
+out:
+	drmModeFreePropertyBlob(blob);
+}
+
+static void plane_caps(FILE *out, int fd, struct drm_snapshot *snap, struct drm_snap_plane *plane)
+{
+	struct drm_snap_prop *sp;
+	drmModePropertyRes *prop;
+	const char *type;
+	uint32_t i;
+
+	type = prop_enum_name(fd, snap_prop(snap, &plane->props, "type"));
+
+	fprintf(out, "\tplane %u: %s", plane->plane_id, type ? type : "unknown type");
+
+	sp = snap_prop(snap, &plane->props, "zpos");
+	if (sp) {
+		prop = drm_prop_get(fd, sp->prop_id);
+		if (prop && prop->count_values == 2 && !(sp->flags & DRM_MODE_PROP_IMMUTABLE))
+			fprintf(out, ", zpos %llu [%llu, %llu]", (unsigned long long) sp->value,
+				(unsigned long long) prop->values[0], (unsigned long long) prop->values[1]);
+		else
+			fprintf(out, ", zpos %llu fixed", (unsigned long long) sp->value);
+	}
+
+	fprintf(out, ", %s\n", plane->crtc_id ? "in use" : "free");
+
+	fprintf(out, "\t\tformats:");
+	for (i = 0; i < plane->formats.count; i++)
+		fprintf(out, " %s", format_str(snap->ids[plane->formats.first + i]));
+	fprintf(out, "\n");
+
+	fprintf(out, "\t\tmodifiers: ");
+	plane_modifiers(out, fd, snap, plane);
+	fprintf(out, "\n");
+
+	/* KMS has no scaling cap: the filter property is the only hint short of a test commit */
+	fprintf(out, "\t\tscaling: ");
+	sp = snap_prop(snap, &plane->props, "SCALING_FILTER");
+	if (sp) {
+		fprintf(out, "yes, filters ");
+		prop_enum_list(out, fd, sp);
+	} else if (type && !strcmp(type, "Cursor")) {
+		fprintf(out, "no");
+	} else {
+		fprintf(out, "driver dependent");
+	}
+	fprintf(out, "\n");
+
+	sp = snap_prop(snap, &plane->props, "rotation");
+	if (sp) {
+		fprintf(out, "\t\trotation: ");
+		prop_enum_list(out, fd, sp);
+		fprintf(out, "\n");
+	}
+}
+
+/* what the enabled planes fetch now: source size from SRC_W/SRC_H, fb otherwise */
+
+static double current_bandwidth(FILE *out, struct drm_snapshot *snap, struct drm_snap_crtc *crtc)
+{
+	struct drm_snap_plane *plane;
+	struct drm_snap_prop *sw, *sh;
+	struct drm_snap_fb *fb;
+	uint32_t width, height, i;
+	double refresh, mbs, total = 0.0;
+	int bpp;
+
+	refresh = mode_refresh(&crtc->mode);
+
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_PLANES); i++) {
+		plane = &snap->planes[i];
+		if (plane->crtc_id != crtc->crtc_id || !plane->fb_id)
+			continue;
+
+		fb = drm_snapshot_find(snap, DRM_SNAP_FBS, plane->fb_id);
+		sw = snap_prop(snap, &plane->props, "SRC_W");
+		sh = snap_prop(snap, &plane->props, "SRC_H");
+
+		width = sw ? sw->value >> 16 : (fb ? fb->width : 0);
+		height = sh ? sh->value >> 16 : (fb ? fb->height : 0);
+		bpp = fb && fb->pixel_format ? format_bpp(fb->pixel_format) : (fb && fb->bpp ? (int) fb->bpp : 32);
+
+		mbs = layer_bandwidth(width, height, bpp, refresh);
+		total += mbs;
+
+		fprintf(out, "\t\tplane %u: %ux%u %d bpp, %.1f MB/s\n", plane->plane_id, width, height, bpp, mbs);
+	}
+
+	return total;
+}
+
+int caps_run(int fd)
+{
+	struct drm_snapshot *snap;
+	struct drm_snap_crtc *crtc;
+	double mbs, total = 0.0;
+	uint32_t c, i;
+
+	drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
+
+	snap = drm_snapshot_take(fd, false);
+	if (!snap)
+		return -1;
+
+	for (c = 0; c < drm_snapshot_count(snap, DRM_SNAP_CRTCS); c++) {
+		crtc = &snap->crtcs[c];
+
+		printf("\ncrtc %u [index %u]: ", crtc->crtc_id, c);
+		if (crtc->mode_valid)
+			printf("%ux%u@%.2f\n", crtc->mode.hdisplay, crtc->mode.vdisplay, mode_refresh(&crtc->mode));
+		else
+			printf("off\n");
+
+		/* possible_crtcs is a mask of crtc indices in resource order */
+		for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_PLANES); i++) {
+			if (snap->planes[i].possible_crtcs & (1 << c))
+				plane_caps(stdout, fd, snap, &snap->planes[i]);
+		}
+
+		if (!crtc->mode_valid)
+			continue;
+
+		printf("\tscanout now:\n");
+		mbs = current_bandwidth(stdout, snap, crtc);
+		printf("\t\ttotal %.1f MB/s\n", mbs);
+		total += mbs;
+	}
+
+	printf("\nscanout bandwidth, all crtcs: %.1f MB/s\n", total);
+
+	drm_snapshot_free(snap);
+	return 0;
+}
+
+/* proposed layout: "WxH[:bpp][@hz],...", 32 bpp and 60 Hz if left out */
+
+int bandwidth_run(const char *layout)
+{
+	unsigned int width, height, bpp;
+	double refresh, mbs, total = 0.0;
+	const char *p = layout;
+	char *end;
+	int layer = 0;
+
+	while (*p) {
+		width = strtoul(p, &end, 10);
+		if (end == p || *end != 'x')
+			goto invalid;
+
+		p = end + 1;
+		height = strtoul(p, &end, 10);
+		if (end == p)
+			goto invalid;
+
+		p = end;
+		bpp = 32;
+		refresh = 60.0;
+
+		if (*p == ':') {
+			bpp = strtoul(p + 1, &end, 10);
+			p = end;
+		}
+
+		if (*p == '@') {
+			refresh = strtod(p + 1, &end);
+			p = end;
+		}
+
+		if (*p == ',')
+			p++;
+		else if (*p)
+			goto invalid;
+
+		mbs = layer_bandwidth(width, height, bpp, refresh);
+		total += mbs;
+
+		printf("layer %d: %ux%u %u bpp @ %.2f Hz: %.1f MB/s\n", layer++, width, height, bpp, refresh, mbs);
+	}
+
+	printf("total: %.1f MB/s (%.2f GB/s)\n", total, total / 1000.0);
+	return 0;
+
+invalid:
+	fprintf(stderr, "invalid layout '%s' at '%s', expected WxH[:bpp][@hz],...\n", layout, p);
+	return -1;
+}
+
+/* watch: current state only, no probing unless a hotplug uevent came in;
+ * snapshots are diffed by object id and only what changed is printed
+ */
+
+static volatile sig_atomic_t watch_quit = 0;
+
+static void watch_int_handler(int sig)
+{
+	watch_quit = 1;
+}
+
+#define diff_field(out, what, id, old, new, field, changes) do {			\
+	if ((old)->field != (new)->field) {						\
+		fprintf(out, "%s %u: " #field " %u -> %u\n", what, id,		\
+			(unsigned) (old)->field, (unsigned) (new)->field);		\
+		(changes)++;								\
+	}										\
+} while (0)
+
+static int props_diff(FILE *out, const char *what, uint32_t id,
+		struct drm_snapshot *old, struct drm_snap_list *old_list,
+		struct drm_snapshot *new, struct drm_snap_list *new_list)
+{
+	struct drm_snap_prop *op, *np;
+	uint32_t i, j;
+	int changes = 0;
+
+	for (i = 0; i < new_list->count; i++) {
+		np = &new->props[new_list->first + i];
+
+		for (j = 0, op = NULL; j < old_list->count && !op; j++) {
+			if (old->props[old_list->first + j].prop_id == np->prop_id)
+				op = &old->props[old_list->first + j];
+		}
+
+		if (op && op->value == np->value)
+			continue;
+
+		if (op)
+			fprintf(out, "%s %u: %s %llu -> %llu\n", what, id, np->name,
+				(unsigned long long) op->value, (unsigned long long) np->value);
+		else
+			fprintf(out, "%s %u: %s %llu (new)\n", what, id, np->name, (unsigned long long) np->value);
+		changes++;
+	}
+
+	return changes;
+}
+
+int snapshot_diff(struct drm_snapshot *old, struct drm_snapshot *new, FILE *out)
+{
+	struct drm_snap_connector *oconn, *nconn;
+	struct drm_snap_encoder *oenc, *nenc;
+	struct drm_snap_plane *oplane, *nplane;
+	struct drm_snap_crtc *ocrtc, *ncrtc;
+	int changes = 0;
+	uint32_t i;
+
+	for (i = 0; i < drm_snapshot_count(new, DRM_SNAP_CRTCS); i++) {
+		ncrtc = &new->crtcs[i];
+		ocrtc = drm_snapshot_find(old, DRM_SNAP_CRTCS, ncrtc->crtc_id);
+		if (!ocrtc) {
+			fprintf(out, "crtc %u: added\n", ncrtc->crtc_id);
+			changes++;
+			continue;
+		}
+
+		diff_field(out, "crtc", ncrtc->crtc_id, ocrtc, ncrtc, buffer_id, changes);
+		diff_field(out, "crtc", ncrtc->crtc_id, ocrtc, ncrtc, x, changes);
+		diff_field(out, "crtc", ncrtc->crtc_id, ocrtc, ncrtc, y, changes);
+		diff_field(out, "crtc", ncrtc->crtc_id, ocrtc, ncrtc, mode_valid, changes);
+
+		if (ocrtc->mode.clock != ncrtc->mode.clock ||
+				strncmp(ocrtc->mode.name, ncrtc->mode.name, DRM_DISPLAY_MODE_LEN)) {
+			fprintf(out, "crtc %u: mode %.*s@%u -> %.*s@%u\n", ncrtc->crtc_id,
+				DRM_DISPLAY_MODE_LEN, ocrtc->mode.name, ocrtc->mode.vrefresh,
+				DRM_DISPLAY_MODE_LEN, ncrtc->mode.name, ncrtc->mode.vrefresh);
+			changes++;
+		}
+
+		changes += props_diff(out, "crtc", ncrtc->crtc_id, old, &ocrtc->props, new, &ncrtc->props);
+	}
+
+	for (i = 0; i < drm_snapshot_count(old, DRM_SNAP_CRTCS); i++) {
+		if (!drm_snapshot_find(new, DRM_SNAP_CRTCS, old->crtcs[i].crtc_id)) {
+			fprintf(out, "crtc %u: removed\n", old->crtcs[i].crtc_id);
+			changes++;
+		}
+	}
+
+	for (i = 0; i < drm_snapshot_count(new, DRM_SNAP_CONNECTORS); i++) {
+		nconn = &new->connectors[i];
+		oconn = drm_snapshot_find(old, DRM_SNAP_CONNECTORS, nconn->connector_id);
+		if (!oconn) {
+			fprintf(out, "connector %u: added, %s\n", nconn->connector_id,
+				connector_status_str(nconn->connection));
+			changes++;
+			continue;
+		}
+
+		if (oconn->connection != nconn->connection) {
+			fprintf(out, "connector %u: %s -> %s\n", nconn->connector_id,
+				connector_status_str(oconn->connection), connector_status_str(nconn->connection));
+			changes++;
+		}
+
+		diff_field(out, "connector", nconn->connector_id, oconn, nconn, encoder_id, changes);
+		diff_field(out, "connector", nconn->connector_id, oconn, nconn, mm_width, changes);
+		diff_field(out, "connector", nconn->connector_id, oconn, nconn, mm_height, changes);
+
+		if (oconn->modes.count != nconn->modes.count ||
+				memcmp(&old->modes[oconn->modes.first], &new->modes[nconn->modes.first],
+					nconn->modes.count * sizeof(drmModeModeInfo))) {
+			fprintf(out, "connector %u: mode list changed, %u -> %u modes\n", nconn->connector_id,
+				oconn->modes.count, nconn->modes.count);
+			changes++;
+		}
+
+		changes += props_diff(out, "connector", nconn->connector_id, old, &oconn->props, new, &nconn->props);
+	}
+
+	/* DP MST ports come and go with their connectors */
+
+	for (i = 0; i < drm_snapshot_count(old, DRM_SNAP_CONNECTORS); i++) {
+		if (!drm_snapshot_find(new, DRM_SNAP_CONNECTORS, old->connectors[i].connector_id)) {
+			fprintf(out, "connector %u: removed\n", old->connectors[i].connector_id);
+			changes++;
+		}
+	}
+
+	for (i = 0; i < drm_snapshot_count(new, DRM_SNAP_ENCODERS); i++) {
+		nenc = &new->encoders[i];
+		oenc = drm_snapshot_find(old, DRM_SNAP_ENCODERS, nenc->encoder_id);
+		if (oenc)
+			diff_field(out, "encoder", nenc->encoder_id, oenc, nenc, crtc_id, changes);
+	}
+
+	for (i = 0; i < drm_snapshot_count(new, DRM_SNAP_PLANES); i++) {
+		nplane = &new->planes[i];
+		oplane = drm_snapshot_find(old, DRM_SNAP_PLANES, nplane->plane_id);
+		if (!oplane)
+			continue;
+
+		diff_field(out, "plane", nplane->plane_id, oplane, nplane, crtc_id, changes);
+		diff_field(out, "plane", nplane->plane_id, oplane, nplane, fb_id, changes);
+		diff_field(out, "plane", nplane->plane_id, oplane, nplane, crtc_x, changes);
+		diff_field(out, "plane", nplane->plane_id, oplane, nplane, crtc_y, changes);
+		diff_field(out, "plane", nplane->plane_id, oplane, nplane, x, changes);
+		diff_field(out, "plane", nplane->plane_id, oplane, nplane, y, changes);
+
+		changes += props_diff(out, "plane", nplane->plane_id, old, &oplane->props, new, &nplane->props);
+	}
+
+	return changes;
+}
+
+int watch_run(int fd, int interval_ms)
+{
+	struct drm_snapshot *prev, *cur;
+	struct sigaction act;
+	struct pollfd pfd;
+	bool hotplug;
+	uint32_t hint;
+	char stamp[32];
+	struct tm tm;
+	time_t now;
+
+	char *diff;
+	size_t diff_size;
+	FILE *out;
+	int rc, changes;
+
+	prev = drm_snapshot_take(fd, false);
+	if (!prev)
+		return -1;
+
+	act.sa_handler = watch_int_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	/* interval 0: uevents only; without uevents fall back to one second polling */
+	pfd.fd = drm_uevent_open();
+	pfd.events = POLLIN;
+
+	if (pfd.fd < 0 && interval_ms <= 0)
+		interval_ms = 1000;
+
+	printf("watching: %s%s%s\n", interval_ms > 0 ? "polling" : "",
+		interval_ms > 0 && pfd.fd >= 0 ? " and " : "", pfd.fd >= 0 ? "hotplug uevents" : "");
+	fflush(stdout);
+
+	while (!watch_quit) {
+		rc = poll(&pfd, 1, interval_ms > 0 ? interval_ms : -1);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		/* other uevents (usb, block, other cards...) are no reason to look */
+		hotplug = false;
+		if (rc > 0 && (pfd.revents & POLLIN)) {
+			hotplug = drm_uevent_hotplug(pfd.fd, fd, &hint);
+			if (!hotplug)
+				continue;
+		}
+
+		cur = drm_snapshot_take(fd, hotplug);
+		if (!cur)
+			continue;
+
+		out = open_memstream(&diff, &diff_size);
+		if (!out) {
+			drm_snapshot_free(cur);
+			continue;
+		}
+
+		changes = snapshot_diff(prev, cur, out);
+		fclose(out);
+
+		if (changes) {
+			now = time(NULL);
+			localtime_r(&now, &tm);
+			strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+
+			printf("\n%s%s: %d change%s\n%s", stamp, hotplug ? " hotplug" : "",
+				changes, changes > 1 ? "s" : "", diff);
+			fflush(stdout);
+		}
+
+		free(diff);
+		drm_snapshot_free(prev);
+		prev = cur;
+	}
+
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+
+	drm_snapshot_free(prev);
+	return 0;
+}
+
+/* all devices: one thread per card node, each report kept in memory and
+ * printed in card order once everything is joined
+ */
+
+struct device_scan {
+	char path[64];
+	char driver[32];
+	char *render;		/* matching render node, NULL if none */
+	int fd;
+	bool started;
+	pthread_t thread;
+
+	char *report;
+	size_t report_size;
+	double ms;
+	int ret;
+};
+
+static double elapsed_ms(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int card_filter(const struct dirent *entry)
+{
+	return !strncmp(entry->d_name, "card", 4);
+}
+
+static void * device_scan_thread(void *data)
+{
+	struct device_scan *dev = data;
+	struct timespec start, end;
+	FILE *out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	out = open_memstream(&dev->report, &dev->report_size);
+	if (!out) {
+		dev->ret = -1;
+		return NULL;
+	}
+
+	dev->ret = device_info(dev->fd, out);
+	fclose(out);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	dev->ms = elapsed_ms(&start, &end);
+
+	return NULL;
+}
+
+int scan_devices(void)
+{
+	struct dirent **cards;
+	struct device_scan *devs, *dev;
+	struct timespec start, end;
+	unsigned long lookups, fetched;
+	drmVersion *version;
+	int i, count, done = 0;
+
+	count = scandir(device_dir, &cards, card_filter, versionsort);
+	if (count < 0) {
+		perror("scandir");
+		return -1;
+	}
+
+	if (count == 0) {
+		fprintf(stderr, "no card nodes in %s\n", device_dir);
+		free(cards);
+		return -1;
+	}
+
+	devs = calloc(count, sizeof(*devs));
+	if (!devs) {
+		perror("calloc");
+		goto free_cards;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* every device stays open until all are joined: the property cache is keyed by fd */
+
+	for (i = 0; i < count; i++) {
+		dev = &devs[i];
+		snprintf(dev->path, sizeof(dev->path), "%s/%s", device_dir, cards[i]->d_name);
+
+		dev->fd = open(dev->path, O_RDWR);
+		if (dev->fd < 0) {
+			fprintf(stderr, "couldn't open %s, skipping\n", dev->path);
+			continue;
+		}
+
+		version = drmGetVersion(dev->fd);
+		if (version) {
+			snprintf(dev->driver, sizeof(dev->driver), "%s", version->name);
+			drmFreeVersion(version);
+		}
+
+		dev->render = drmGetRenderDeviceNameFromFd(dev->fd);
+
+		if (pthread_create(&dev->thread, NULL, device_scan_thread, dev)) {
+			fprintf(stderr, "failed to start thread for %s\n", dev->path);
+			continue;
+		}
+
+		dev->started = true;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (devs[i].started)
+			pthread_join(devs[i].thread, NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < count; i++) {
+		dev = &devs[i];
+
+		if (!dev->started)
+			continue;
+
+		printf("\n==== %s [%s], render node %s: %.1f ms ====\n", dev->path,
+			dev->driver[0] ? dev->driver : "unknown", dev->render ? dev->render : "none", dev->ms);
+
+		if (dev->report)
+			fwrite(dev->report, 1, dev->report_size, stdout);
+
+		if (dev->ret == 0)
+			done++;
+	}
+
+	drm_prop_cache_stats(&lookups, &fetched);
+
+	printf("\n%d of %d devices, %.1f ms total\n", done, count, elapsed_ms(&start, &end));
+	printf("properties: %lu lookups, %lu fetched\n", lookups, fetched);
+
+	for (i = 0; i < count; i++) {
+		free(devs[i].report);
+		free(devs[i].render);
+		if (devs[i].fd >= 0)
+			close(devs[i].fd);
+	}
+
+	free(devs);
+
+free_cards:
+	for (i = 0; i < count; i++)
+		free(cards[i]);
+	free(cards);
+
+	return done ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct drm_snapshot *snap;
+	char *snapshot_out = NULL;
+	char *snapshot_in = NULL;
+	bool json = false;
+	int profile = 0;
+	int watch = -1;
+	bool caps = false;
+
+	static const struct option long_options[] = {
+		{ "profile", required_argument, NULL, 'p' },
+		{ "watch", required_argument, NULL, 'w' },
+		{ "caps", no_argument, NULL, 'c' },
+		{ "bandwidth", required_argument, NULL, 'B' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	const char *device = NULL;
+	unsigned long lookups, fetched;
+	int fd, ret = 0, opt;
+
+	while ((opt = getopt_long(argc, argv, "jb:r:p:d:w:cB:qh", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'q':
+				probe = false;
+				drm_set_probe(false);
+				break;
+			case 'j':
+				json = true;
+				break;
+			case 'b':
+				snapshot_out = optarg;
+				break;
+			case 'r':
+				snapshot_in = optarg;
+				break;
+			case 'd':
+				device = optarg;
+				break;
+			case 'w':
+				watch = atoi(optarg);
+				break;
+			case 'c':
+				caps = true;
+				break;
+			case 'B':
+				return bandwidth_run(optarg);
+			case 'p':
+				profile = atoi(optarg);
+				if (profile < 1) {
+					usage(argv[0]);
+					exit(-1);
+				}
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				exit(0);
+		}
+	}
+
+	/* saved snapshot: mapped as is, the device is not touched */
+
+	if (snapshot_in) {
+		snap = drm_snapshot_load(snapshot_in);
+		if (!snap)
+			return -1;
+
+		snapshot_json(snap, stdout);
+		drm_snapshot_free(snap);
+		return 0;
+	}
+
+	/* text dump with no device given: every card at once */
+
+	if (!device && !json && !snapshot_out && !profile && watch < 0 && !caps) {
+		ret = scan_devices();
+		goto exit;
+	}
+
+	if (!device)
+		device = device_name;
+
+    fd = open(device, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "couldn't open %s, skipping\n", device);
+		ret = -1;
+		goto exit;
+    }
+
+	if (profile) {
+		ret = profile_run(fd, profile);
+		goto close_fd;
+	}
+
+	if (watch >= 0) {
+		ret = watch_run(fd, watch);
+		goto close_fd;
+	}
+
+	if (caps) {
+		ret = caps_run(fd);
+		goto close_fd;
+	}
+
+	if (json || snapshot_out) {
+		snap = drm_snapshot_take(fd, probe);
+		if (!snap) {
+			ret = -1;
+			goto close_fd;
+		}
+
+		if (snapshot_out && drm_snapshot_save(snap, snapshot_out))
+			ret = -1;
+
+		if (json)
+			snapshot_json(snap, stdout);
+
+		drm_snapshot_free(snap);
+
+		if (json)
+			goto close_fd;
+	}
+
+	ret = device_info(fd, stdout);
+
+	drm_prop_cache_stats(&lookups, &fetched);
+	printf("\nproperties: %lu lookups, %lu fetched\n", lookups, fetched);
 
 close_fd:
     close(fd);
 
 exit:
+	drm_prop_cache_free();
     return ret;
 }
@@ -18,6 +18,8 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include "ring_utils.h"
+
 /* */
 
 #define DRM_SERVER_NAME	"/tmp/drm_srv"
@@ -65,12 +67,74 @@
 		command:uint32_t
 	}
 
+	CMD_RING = {
+		magic:uint32_t
+		command:uint32_t
+	}
+
+	CMD_STATS = {
+		magic:uint32_t
+		command:uint32_t
+	}
+
+	CMD_CURSOR = {
+		magic:uint32_t
+		command:uint32_t
+		crtc_id:uint32_t
+		x:int32_t
+		y:int32_t
+		visible:uint32_t
+	}
+
+	CMD_RING carries two descriptors as SCM_RIGHTS: a sealed memfd holding
+	struct drm_ring and an eventfd used as doorbell. After DRM_OK the client
+	posts plane updates to the ring and signals the doorbell; the server
+	drains all rings on the next vblank, without replies or notifications.
+	Ring updates always go to the plane and crtc of the client's CMD_PLANE,
+	ids in the ring entries are ignored; CMD_PLANE_STOP drops the ring
+	together with updates not drained yet.
+
+	CMD_CURSOR moves the hardware cursor hotspot of the crtc to (x, y); the
+	server uploads its cursor image once per crtc, on first use. Only the
+	crtc set up by the client's CMD_CRTC or CMD_PLANE is accepted.
+	Visibility changes at once, a cursor being shown lands on (x, y) right
+	away; other moves are applied on the next vblank and only the latest one
+	per crtc reaches the hardware. The cursor is hidden when its client
+	disconnects.
+
 */
 
 /* response:
 
 	| magic:uint32_t | value:uint32_t |
 
+	CMD_CRTC and CMD_PLANE are applied on the next vblank of the crtc and
+	answered then; a request superseded by a newer one for the same crtc or
+	plane before that vblank is not applied and is answered DRM_COALESCED
+
+	CMD_CURSOR is answered right away, without a notification
+
+	CMD_STATS response appends server counters:
+
+	| requests:ulong | updates:ulong | commits:ulong | coalesced:ulong |
+
+*/
+
+/* notification:
+
+	sent asynchronously after each successful CMD_CRTC or CMD_PLANE,
+	once the new configuration has reached the screen; sequence is the
+	vblank counter of the crtc and tv_sec/tv_usec is the kernel vblank
+	timestamp (CLOCK_MONOTONIC)
+
+	DRM_PRESENTED = {
+		magic:uint32_t
+		value:uint32_t
+		sequence:uint32_t
+		tv_sec:uint32_t
+		tv_usec:uint32_t
+	}
+
 */
 
 /* client requests */
@@ -81,6 +145,9 @@ enum {
 	CMD_PLANE,
 	CMD_CRTC_STOP,
 	CMD_PLANE_STOP,
+	CMD_RING,
+	CMD_STATS,
+	CMD_CURSOR,
 };
 
 /* server responses */
@@ -88,12 +155,15 @@ enum {
 enum {
 	DRM_OK,
 	DRM_ERROR,
+	DRM_PRESENTED,
+	DRM_COALESCED,
 };
 
 /* */
 
 struct drm_client_info {
 	drm_magic_t magic;
+	int sock;
     drmModeCrtcPtr saved_crtc;
     drmModeCrtcPtr current_crtc;
 	uint32_t crtc_id;
@@ -105,7 +175,9 @@ struct drm_client_info {
 	uint32_t y;
 	uint32_t fb;
 	char mode_name[20];
-	drmModeModeInfo *mode;
+	drmModeModeInfo mode;
+	struct drm_ring *ring;
+	int doorbell;
 };
 
 /* */
@@ -3,7 +3,9 @@
 #include <sys/poll.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -13,6 +15,7 @@
 #include <stdio.h>
 #include <error.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -21,13 +24,142 @@
 #include <xf86drm.h>
 #include <libkms.h>
 
+#include "bitmap_utils.h"
 #include "drm_utils.h"
 #include "drm_proto.h"
 
 /* */
 
 static const char device_name[] = "/dev/dri/card0";
-static bool running  = true;
+static atomic_bool running  = true;
+
+/* threads:
+ *   main (I/O) thread owns listening and client sockets, reads and decodes
+ *   requests and passes them to the KMS thread through a lock-free queue;
+ *   KMS thread owns the drm device, client state and mailboxes, commits
+ *   updates and writes all replies and notifications to client sockets
+ */
+
+/* I/O thread poll set layout: client sockets, server socket */
+
+#define POLL_SERVER		MAXCLIENTS
+#define POLL_IO_SIZE	(MAXCLIENTS + 1)
+
+/* KMS thread poll set layout: drm device, request queue, hotplug uevents, client ring doorbells */
+
+#define POLL_DRM		0
+#define POLL_QUEUE		1
+#define POLL_UEVENT		2
+#define POLL_RING(i)	(3 + (i))
+#define POLL_KMS_SIZE	(MAXCLIENTS + 3)
+
+/* vblank event user data: client generation, event type and client slot or mailbox index */
+
+enum {
+	EV_PRESENT,
+	EV_FLUSH,
+};
+
+#define VBLANK_EV(type, slot, gen)	((void *) (unsigned long) (((unsigned long) (gen) << 16) | ((type) << 8) | (slot)))
+#define VBLANK_EV_GEN(data)		(((unsigned long) (data) >> 16) & 0xffff)
+#define VBLANK_EV_TYPE(data)		(((unsigned long) (data) >> 8) & 0xff)
+#define VBLANK_EV_SLOT(data)		((unsigned long) (data) & 0xff)
+
+/* decoded client request passed from I/O thread to KMS thread */
+
+#define CMD_DISCONNECT	0x100	/* internal: client socket is gone */
+
+struct server_cmd {
+	int slot;
+	int sock;
+	drm_magic_t magic;
+	uint32_t command;
+	uint32_t crtc_id;
+	uint32_t conn_id;
+	uint32_t plane_id;
+	uint32_t fb;
+	uint32_t w;
+	uint32_t h;
+	uint32_t x;
+	uint32_t y;
+	uint32_t visible;
+	char mode_name[20];
+	int fds[DRM_RING_MAXFDS];
+	int nfds;
+	struct timespec ts;		/* request decoded */
+};
+
+#define QUEUE_SIZE	64		/* must be a power of two */
+
+struct server_queue {
+	_Atomic uint32_t head;
+	char pad0[60];
+	_Atomic uint32_t tail;
+	char pad1[60];
+	struct server_cmd cmds[QUEUE_SIZE];
+};
+
+/* mailboxes: latest pending state per plane and per crtc, flushed once per vblank */
+
+#define MAXPLANES	32
+#define MAXCRTCS	8
+
+struct plane_mailbox {
+	uint32_t plane_id;
+	bool pending;
+	int slot;				/* posting client, -1 for ring updates */
+	drm_magic_t magic;
+	struct timespec ts;
+	struct drm_ring_cmd cmd;
+};
+
+struct crtc_mailbox {
+	uint32_t crtc_id;
+	bool armed;				/* flush is queued for the next vblank */
+	bool pending;
+	int slot;
+	drm_magic_t magic;
+	struct timespec ts;
+	uint32_t fb;
+	uint32_t conn_id;
+	drmModeModeInfo mode;
+	struct drm_cursor cursor;	/* set up on first CMD_CURSOR, handle is 0 until then */
+	int cursor_slot;		/* client that last posted CMD_CURSOR, -1 if none */
+};
+
+struct server_stats {
+	unsigned long requests;
+	unsigned long updates;	/* plane and crtc updates posted by clients and rings */
+	unsigned long commits;	/* update ioctls actually issued */
+	unsigned long coalesced;	/* superseded updates, i.e. ioctls saved */
+	unsigned long answered;	/* requests answered, latency below is over them */
+	unsigned long queue_sum_us;
+	unsigned long queue_max_us;
+	unsigned long latency_sum_us;
+	unsigned long latency_max_us;
+};
+
+/* shared by both threads */
+
+static struct server_queue queue;
+static int queue_bell;
+static int queue_space;			/* blocking eventfd, rung when a full queue gets a free cell */
+static atomic_bool queue_waiting;
+static atomic_bool slot_busy[MAXCLIENTS];
+
+/* owned by KMS thread */
+
+static struct drm_client_info drm_clients[MAXCLIENTS];
+static uint16_t slot_gen[MAXCLIENTS];	/* bumped whenever a slot changes hands */
+static struct pollfd kms_fds[POLL_KMS_SIZE];
+static bool ring_drain_armed = false;
+
+static struct plane_mailbox plane_mb[MAXPLANES];
+static struct crtc_mailbox crtc_mb[MAXCRTCS];
+static int plane_mb_count = 0;
+static int crtc_mb_count = 0;
+
+static struct server_stats stats;
 
 /* */
 
@@ -35,6 +167,1010 @@ void int_handler(int);
 
 /* */
 
+static unsigned long elapsed_us(struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - from->tv_sec) * 1000000L + (now.tv_nsec - from->tv_nsec) / 1000;
+}
+
+static void stats_dump(void)
+{
+	fprintf(stdout, "stats: requests %lu, updates %lu, commits %lu, coalesced %lu (ioctls saved)\n",
+		stats.requests, stats.updates, stats.commits, stats.coalesced);
+
+	if (stats.answered)
+		fprintf(stdout, "stats: latency avg %lu us max %lu us, queued avg %lu us max %lu us\n",
+			stats.latency_sum_us / stats.answered, stats.latency_max_us,
+			stats.queue_sum_us / stats.answered, stats.queue_max_us);
+}
+
+/* */
+
+static void queue_space_ring(void)
+{
+	uint64_t bell = 1;
+
+	write(queue_space, &bell, sizeof(bell));
+}
+
+static void queue_push(struct server_cmd *cmd)
+{
+	uint32_t head = atomic_load_explicit(&queue.head, memory_order_relaxed);
+	uint64_t bell = 1;
+
+	/* KMS thread is busy with a modeset: sleep until it frees a cell */
+	while (head - atomic_load_explicit(&queue.tail, memory_order_acquire) >= QUEUE_SIZE) {
+		if (!atomic_load(&running))
+			return;
+
+		/* announce before the re-check, a cell freed in between leaves the counter set */
+		atomic_store(&queue_waiting, true);
+		if (head - atomic_load(&queue.tail) >= QUEUE_SIZE)
+			read(queue_space, &bell, sizeof(bell));
+		atomic_store(&queue_waiting, false);
+	}
+
+	queue.cmds[head & (QUEUE_SIZE - 1)] = *cmd;
+	atomic_store_explicit(&queue.head, head + 1, memory_order_release);
+
+	write(queue_bell, &bell, sizeof(bell));
+}
+
+static bool queue_pop(struct server_cmd *cmd)
+{
+	uint32_t tail = atomic_load_explicit(&queue.tail, memory_order_relaxed);
+
+	if (tail == atomic_load_explicit(&queue.head, memory_order_acquire))
+		return false;
+
+	*cmd = queue.cmds[tail & (QUEUE_SIZE - 1)];
+	atomic_store(&queue.tail, tail + 1);
+
+	if (atomic_exchange(&queue_waiting, false))
+		queue_space_ring();
+
+	return true;
+}
+
+/* */
+
+static void latency_account(int slot, struct timespec *ts)
+{
+	unsigned long us = elapsed_us(ts);
+
+	stats.answered++;
+	stats.latency_sum_us += us;
+	if (us > stats.latency_max_us)
+		stats.latency_max_us = us;
+
+	fprintf(stdout, "client %d: request served in %lu us\n", slot, us);
+}
+
+static void client_reply(int slot, drm_magic_t magic, int value, struct timespec *ts)
+{
+	char tx_buf[DRM_SRV_MSGLEN + 1];
+
+	/* client is gone or slot was reused since the request */
+	if (slot < 0 || drm_clients[slot].sock == -1 || drm_clients[slot].magic != magic)
+		return;
+
+	bzero(tx_buf, sizeof(tx_buf));
+	snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, value);
+
+	fprintf(stdout, "send to client %d response [%s]\n", slot, tx_buf);
+	write(drm_clients[slot].sock, tx_buf, sizeof(tx_buf));
+
+	latency_account(slot, ts);
+}
+
+/* presentation of a commit is reported to the client that made it only */
+
+static void present_queue(int fd, uint32_t crtc_id, int slot, drm_magic_t magic)
+{
+	if (slot < 0 || drm_clients[slot].sock == -1 || drm_clients[slot].magic != magic)
+		return;
+
+	if (drm_queue_vblank_event(fd, crtc_id, VBLANK_EV(EV_PRESENT, slot, slot_gen[slot])))
+		perror("failed drm_queue_vblank_event");
+}
+
+static void present_notify(int slot, uint16_t gen, unsigned int frame, unsigned int sec, unsigned int usec)
+{
+	struct drm_client_info *client = &drm_clients[slot];
+	char tx_buf[DRM_SRV_MSGLEN + 1];
+
+	/* client is gone or slot was reused since the commit */
+	if (client->sock == -1 || slot_gen[slot] != gen)
+		return;
+
+	bzero(tx_buf, sizeof(tx_buf));
+	snprintf(tx_buf, sizeof(tx_buf), "%d:%d:%u:%u:%u", client->magic, DRM_PRESENTED, frame, sec, usec);
+
+	fprintf(stdout, "send to client notification [%s]\n", tx_buf);
+	write(client->sock, tx_buf, sizeof(tx_buf));
+}
+
+static void ring_doorbells_enable(bool enable)
+{
+	int i;
+
+	for (i = 0; i < MAXCLIENTS; i++)
+		kms_fds[POLL_RING(i)].events = enable ? POLLIN : 0;
+}
+
+static void ring_release(int i)
+{
+	if (!drm_clients[i].ring)
+		return;
+
+	drm_ring_unmap(drm_clients[i].ring);
+	close(drm_clients[i].doorbell);
+
+	drm_clients[i].ring = NULL;
+	drm_clients[i].doorbell = -1;
+	kms_fds[POLL_RING(i)].fd = -1;
+}
+
+/* */
+
+/* mailbox slots are never freed: only ids of existing objects get one */
+
+static bool kms_object_valid(int fd, uint32_t id, uint32_t type)
+{
+	struct drm_topology *topo;
+
+	if (!id)
+		return false;
+
+	topo = drm_topology_get(fd);
+	return topo && drm_topology_index(topo, id, type) >= 0;
+}
+
+static struct crtc_mailbox * crtc_mailbox_find(uint32_t crtc_id)
+{
+	int i;
+
+	if (!crtc_id)
+		return NULL;
+
+	for (i = 0; i < crtc_mb_count; i++) {
+		if (crtc_mb[i].crtc_id == crtc_id)
+			return &crtc_mb[i];
+	}
+
+	return NULL;
+}
+
+static struct crtc_mailbox * crtc_mailbox_get(int fd, uint32_t crtc_id)
+{
+	struct crtc_mailbox *cm;
+
+	cm = crtc_mailbox_find(crtc_id);
+	if (cm)
+		return cm;
+
+	if (!kms_object_valid(fd, crtc_id, DRM_MODE_OBJECT_CRTC)) {
+		fprintf(stderr, "no crtc %u, no mailbox for it\n", crtc_id);
+		return NULL;
+	}
+
+	if (crtc_mb_count == MAXCRTCS) {
+		fprintf(stderr, "too many crtcs, no mailbox for crtc %u\n", crtc_id);
+		return NULL;
+	}
+
+	bzero(&crtc_mb[crtc_mb_count], sizeof(struct crtc_mailbox));
+	crtc_mb[crtc_mb_count].crtc_id = crtc_id;
+	crtc_mb[crtc_mb_count].cursor_slot = -1;
+
+	return &crtc_mb[crtc_mb_count++];
+}
+
+static struct plane_mailbox * plane_mailbox_get(int fd, uint32_t plane_id)
+{
+	int i;
+
+	for (i = 0; i < plane_mb_count; i++) {
+		if (plane_mb[i].plane_id == plane_id)
+			return &plane_mb[i];
+	}
+
+	if (!kms_object_valid(fd, plane_id, DRM_MODE_OBJECT_PLANE)) {
+		fprintf(stderr, "no plane %u, no mailbox for it\n", plane_id);
+		return NULL;
+	}
+
+	if (plane_mb_count == MAXPLANES) {
+		fprintf(stderr, "too many planes, no mailbox for plane %u\n", plane_id);
+		return NULL;
+	}
+
+	bzero(&plane_mb[plane_mb_count], sizeof(struct plane_mailbox));
+	plane_mb[plane_mb_count].plane_id = plane_id;
+
+	return &plane_mb[plane_mb_count++];
+}
+
+static void mailbox_flush(int fd, struct crtc_mailbox *cm);
+
+/* schedule flush of crtc mailbox on the next vblank; crtc without vblanks
+ * (e.g. disabled one) can not coalesce anything, so flush it right away
+ */
+
+static void mailbox_arm(int fd, struct crtc_mailbox *cm)
+{
+	if (cm->armed)
+		return;
+
+	if (drm_queue_vblank_event(fd, cm->crtc_id, VBLANK_EV(EV_FLUSH, cm - crtc_mb, 0))) {
+		mailbox_flush(fd, cm);
+		return;
+	}
+
+	cm->armed = true;
+}
+
+static int mailbox_post_plane(int fd, int slot, drm_magic_t magic, struct timespec *ts, struct drm_ring_cmd *cmd)
+{
+	struct plane_mailbox *pm;
+	struct crtc_mailbox *cm;
+
+	pm = plane_mailbox_get(fd, cmd->plane_id);
+	cm = crtc_mailbox_get(fd, cmd->crtc_id);
+
+	if (!pm || !cm)
+		return -1;
+
+	stats.updates++;
+
+	if (pm->pending) {
+		stats.coalesced++;
+		client_reply(pm->slot, pm->magic, DRM_COALESCED, &pm->ts);
+	}
+
+	pm->pending = true;
+	pm->slot = slot;
+	pm->magic = magic;
+	pm->cmd = *cmd;
+
+	if (ts)
+		pm->ts = *ts;
+
+	mailbox_arm(fd, cm);
+	return 0;
+}
+
+static int mailbox_post_crtc(int fd, int slot, drm_magic_t magic, struct timespec *ts, uint32_t crtc_id,
+		uint32_t fb, uint32_t conn_id, drmModeModeInfo *mode)
+{
+	struct crtc_mailbox *cm;
+
+	cm = crtc_mailbox_get(fd, crtc_id);
+	if (!cm)
+		return -1;
+
+	stats.updates++;
+
+	if (cm->pending) {
+		stats.coalesced++;
+		client_reply(cm->slot, cm->magic, DRM_COALESCED, &cm->ts);
+	}
+
+	cm->pending = true;
+	cm->slot = slot;
+	cm->magic = magic;
+	cm->ts = *ts;
+	cm->fb = fb;
+	cm->conn_id = conn_id;
+	cm->mode = *mode;
+
+	mailbox_arm(fd, cm);
+	return 0;
+}
+
+/* cursor of the crtc: server image is uploaded once, clients only move it */
+
+static int mailbox_cursor_setup(int fd, struct crtc_mailbox *cm)
+{
+	uint32_t *image;
+	int ret;
+
+	if (drm_cursor_init(fd, cm->crtc_id, &cm->cursor))
+		return -1;
+
+	image = malloc(cm->cursor.width * cm->cursor.height * 4);
+	if (!image) {
+		drm_cursor_fini(&cm->cursor);
+		return -1;
+	}
+
+	draw_cursor_image(image, cm->cursor.width, cm->cursor.height);
+	ret = drm_cursor_set_image(&cm->cursor, image, cm->cursor.width, cm->cursor.height, 0, 0);
+	free(image);
+
+	if (ret)
+		drm_cursor_fini(&cm->cursor);
+
+	return ret;
+}
+
+static int mailbox_post_cursor(int fd, int slot, uint32_t crtc_id, int x, int y, bool visible)
+{
+	struct crtc_mailbox *cm;
+
+	cm = crtc_mailbox_get(fd, crtc_id);
+	if (!cm)
+		return -1;
+
+	if (!cm->cursor.handle && mailbox_cursor_setup(fd, cm))
+		return -1;
+
+	cm->cursor_slot = slot;
+
+	stats.updates++;
+
+	if (drm_cursor_move(&cm->cursor, x, y))
+		stats.coalesced++;
+
+	/* visibility changes at once; a cursor that just appeared is moved in
+	 * the same request, it must not sit at a stale position until the vblank
+	 */
+	if (visible != cm->cursor.visible) {
+		if (drm_cursor_show(&cm->cursor, visible))
+			return -1;
+
+		if (visible) {
+			stats.commits++;
+			drm_cursor_flush(&cm->cursor);
+		}
+
+		return 0;
+	}
+
+	if (visible)
+		mailbox_arm(fd, cm);
+
+	return 0;
+}
+
+/* cursor a client left on screen goes away with the client */
+
+static void mailbox_hide_cursor(int slot, uint32_t crtc_id)
+{
+	struct crtc_mailbox *cm;
+
+	cm = crtc_mailbox_find(crtc_id);
+	if (cm && cm->cursor.handle && cm->cursor_slot == slot)
+		drm_cursor_show(&cm->cursor, false);
+}
+
+/* drop pending plane update: it must not be applied after the plane is stopped */
+
+static void mailbox_cancel_plane(uint32_t plane_id)
+{
+	int i;
+
+	for (i = 0; i < plane_mb_count; i++) {
+		if (plane_mb[i].plane_id != plane_id || !plane_mb[i].pending)
+			continue;
+
+		stats.coalesced++;
+		client_reply(plane_mb[i].slot, plane_mb[i].magic, DRM_COALESCED, &plane_mb[i].ts);
+		plane_mb[i].pending = false;
+	}
+}
+
+static void mailbox_cancel_crtc(uint32_t crtc_id)
+{
+	int i;
+
+	for (i = 0; i < crtc_mb_count; i++) {
+		if (crtc_mb[i].crtc_id != crtc_id || !crtc_mb[i].pending)
+			continue;
+
+		stats.coalesced++;
+		client_reply(crtc_mb[i].slot, crtc_mb[i].magic, DRM_COALESCED, &crtc_mb[i].ts);
+		crtc_mb[i].pending = false;
+	}
+}
+
+/* move everything posted to client rings since the previous vblank to mailboxes;
+ * a ring only moves the plane its client set up with CMD_PLANE, ids written
+ * to shared memory are not trusted
+ */
+
+static void ring_drain(int fd)
+{
+	struct drm_ring_cmd cmd;
+	int i;
+
+	for (i = 0; i < MAXCLIENTS; i++) {
+
+		if (!drm_clients[i].ring)
+			continue;
+
+		while (drm_ring_pop(drm_clients[i].ring, &cmd)) {
+			if (!drm_clients[i].plane_id || !drm_clients[i].crtc_id)
+				continue;
+
+			cmd.plane_id = drm_clients[i].plane_id;
+			cmd.crtc_id = drm_clients[i].crtc_id;
+			mailbox_post_plane(fd, -1, 0, NULL, &cmd);
+		}
+	}
+
+	ring_drain_armed = false;
+	ring_doorbells_enable(true);
+}
+
+static void mailbox_flush(int fd, struct crtc_mailbox *cm)
+{
+	struct drm_client_info *client;
+	struct plane_mailbox *pm;
+	int i, ret;
+
+	/* ring updates for this crtc land in the mailbox while it is still armed */
+	if (ring_drain_armed)
+		ring_drain(fd);
+
+	cm->armed = false;
+
+	if (cm->pending) {
+		cm->pending = false;
+		stats.commits++;
+
+		ret = drmModeSetCrtc(fd, cm->crtc_id, cm->fb, 0, 0, &cm->conn_id, 1, &cm->mode);
+		if (ret) {
+			perror("failed drmModeSetCrtc(new)");
+			client_reply(cm->slot, cm->magic, DRM_ERROR, &cm->ts);
+		} else if (cm->slot >= 0) {
+			client = &drm_clients[cm->slot];
+
+			if (client->magic == cm->magic) {
+				if (client->current_crtc)
+					drmModeFreeCrtc(client->current_crtc);
+
+				client->current_crtc = drmModeGetCrtc(fd, cm->crtc_id);
+				if (client->current_crtc != NULL)
+					dump_crtc_configuration("current_crtc", client->current_crtc);
+			}
+
+			client_reply(cm->slot, cm->magic, DRM_OK, &cm->ts);
+			present_queue(fd, cm->crtc_id, cm->slot, cm->magic);
+		}
+	}
+
+	for (i = 0; i < plane_mb_count; i++) {
+		pm = &plane_mb[i];
+
+		if (!pm->pending || pm->cmd.crtc_id != cm->crtc_id)
+			continue;
+
+		pm->pending = false;
+		stats.commits++;
+
+		ret = drmModeSetPlane(fd, pm->cmd.plane_id, pm->cmd.crtc_id,
+				pm->cmd.fb, 0, pm->cmd.x, pm->cmd.y,
+				pm->cmd.w, pm->cmd.h, 0, 0,
+				pm->cmd.w << 16, pm->cmd.h << 16);
+
+		if (ret) {
+			perror("cannot set plane");
+			client_reply(pm->slot, pm->magic, DRM_ERROR, &pm->ts);
+			continue;
+		}
+
+		if (pm->slot < 0)
+			continue;
+
+		client_reply(pm->slot, pm->magic, DRM_OK, &pm->ts);
+		present_queue(fd, pm->cmd.crtc_id, pm->slot, pm->magic);
+	}
+
+	/* latest cursor position only: moves since the previous vblank are coalesced */
+
+	if (cm->cursor.handle && cm->cursor.moved && cm->cursor.visible) {
+		stats.commits++;
+		drm_cursor_flush(&cm->cursor);
+	}
+}
+
+static void vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
+{
+	switch (VBLANK_EV_TYPE(data)) {
+		case EV_PRESENT:
+			present_notify(VBLANK_EV_SLOT(data), VBLANK_EV_GEN(data), frame, sec, usec);
+			break;
+
+		case EV_FLUSH:
+			mailbox_flush(fd, &crtc_mb[VBLANK_EV_SLOT(data)]);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* I/O thread: parse request text into server_cmd */
+
+static void request_decode(char *rx_buf, struct server_cmd *cmd)
+{
+	uint32_t a, b;
+
+	sscanf(rx_buf, "%d:%d", &cmd->magic, &cmd->command);
+	fprintf(stdout, "accepted request [%s] -> (%d, %d)\n", rx_buf, cmd->magic, cmd->command);
+
+	switch (cmd->command) {
+		case CMD_CRTC:
+			sscanf(rx_buf, "%d:%d:%d:%d:%d:%19s", &a, &b,
+				&cmd->crtc_id, &cmd->conn_id, &cmd->fb, cmd->mode_name);
+
+			fprintf(stdout, "got req: %d:%d:%d:%d:%d:%s\n", a, b,
+				cmd->crtc_id, cmd->conn_id, cmd->fb, cmd->mode_name);
+			break;
+
+		case CMD_PLANE:
+			sscanf(rx_buf, "%d:%d:%d:%d:%d:%d:%d:%d:%d", &a, &b,
+				&cmd->crtc_id, &cmd->plane_id, &cmd->fb,
+				&cmd->w, &cmd->h, &cmd->x, &cmd->y);
+
+			fprintf(stdout, "got req: %d:%d:%d:%d:%d:%d:%d:%d:%d\n", a, b,
+				cmd->crtc_id, cmd->plane_id, cmd->fb,
+				cmd->w, cmd->h, cmd->x, cmd->y);
+			break;
+
+		case CMD_CURSOR:
+			sscanf(rx_buf, "%d:%d:%d:%d:%d:%d", &a, &b,
+				&cmd->crtc_id, &cmd->x, &cmd->y, &cmd->visible);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* KMS thread: execute decoded request */
+
+static void request_handle(int fd, struct server_cmd *cmd)
+{
+	struct drm_client_info *client = &drm_clients[cmd->slot];
+	char tx_buf[DRM_SRV_MSGLEN + 1];
+	bool deferred = false;
+	int ret = -1;
+
+	bzero(tx_buf, sizeof(tx_buf));
+
+	switch (cmd->command) {
+		case CMD_DISCONNECT:	/* client socket is gone: slot may be reused */
+			mailbox_hide_cursor(cmd->slot, client->crtc_id);
+			ring_release(cmd->slot);
+			client->sock = -1;
+			client->magic = 0;
+			slot_gen[cmd->slot]++;
+			close(cmd->sock);
+			atomic_store(&slot_busy[cmd->slot], false);
+			return;
+
+		case CMD_AUTH:	/* authenticate client */
+			do {
+				ret = drmAuthMagic(fd, cmd->magic);
+
+				if (ret) {
+					perror("failed drmAuthMagic");
+					ret = -1;
+					break;
+				} else {
+					ring_release(cmd->slot);
+					bzero(client, sizeof(struct drm_client_info));
+					client->magic = cmd->magic;
+					client->sock = cmd->sock;
+					client->doorbell = -1;
+					slot_gen[cmd->slot]++;
+				}
+
+				snprintf(tx_buf, sizeof(tx_buf), "%d:%d", cmd->magic, DRM_OK);
+			} while (0);
+
+			break;
+
+		case CMD_CRTC:	/* save old crtc and create new crtc */
+			do {
+				drmModeModeInfo *tm;
+
+				client->crtc_id = cmd->crtc_id;
+				client->conn_id = cmd->conn_id;
+				client->fb = cmd->fb;
+				strcpy(client->mode_name, cmd->mode_name);
+
+				tm = drm_get_mode_by_name(fd, client->conn_id, client->mode_name);
+
+				if (!tm) {
+					perror("failed drm_get_mode_by_name");
+					ret = -1;
+					break;
+				}
+
+				/* keep a copy: cached modes go away on hotplug */
+				client->mode = *tm;
+
+				/* store current crtc */
+
+				client->saved_crtc = drmModeGetCrtc(fd, client->crtc_id);
+				if (client->saved_crtc == NULL) {
+					perror("failed drmModeGetCrtc(current)");
+					ret = -1;
+					break;
+				}
+
+				dump_crtc_configuration("saved_crtc", client->saved_crtc);
+
+				/* setup new crtc on the next vblank, reply is sent on flush */
+
+				ret = mailbox_post_crtc(fd, cmd->slot, cmd->magic, &cmd->ts, client->crtc_id,
+						client->fb, client->conn_id, &client->mode);
+
+				if (ret) {
+					ret = -1;
+					break;
+				}
+
+				deferred = true;
+			} while (0);
+
+			break;
+
+		case CMD_PLANE:	/* setup plane */
+			do {
+				struct drm_ring_cmd rcmd;
+
+				client->crtc_id = cmd->crtc_id;
+				client->plane_id = cmd->plane_id;
+				client->fb = cmd->fb;
+				client->w = cmd->w;
+				client->h = cmd->h;
+				client->x = cmd->x;
+				client->y = cmd->y;
+
+				rcmd.crtc_id = client->crtc_id;
+				rcmd.plane_id = client->plane_id;
+				rcmd.fb = client->fb;
+				rcmd.w = client->w;
+				rcmd.h = client->h;
+				rcmd.x = client->x;
+				rcmd.y = client->y;
+
+				/* setup plane on the next vblank, reply is sent on flush */
+
+				ret = mailbox_post_plane(fd, cmd->slot, cmd->magic, &cmd->ts, &rcmd);
+
+				if (ret) {
+					ret = -1;
+					break;
+				}
+
+				deferred = true;
+			} while (0);
+
+			break;
+
+		case CMD_CRTC_STOP:	/* client disconnects */
+			do {
+				struct crtc_mailbox *cm;
+
+				mailbox_cancel_crtc(client->crtc_id);
+
+				cm = crtc_mailbox_find(client->crtc_id);
+				if (cm && cm->cursor.handle)
+					drm_cursor_show(&cm->cursor, false);
+
+				if (client->saved_crtc && client->saved_crtc->mode_valid) {
+					ret = drmModeSetCrtc(fd, client->saved_crtc->crtc_id,
+							client->saved_crtc->buffer_id,
+							client->saved_crtc->x, client->saved_crtc->y,
+							&(client->conn_id), 1, &(client->saved_crtc->mode));
+
+					if (ret) {
+						perror("failed drmModeSetCrtc(restore original)");
+						ret = -1;
+						break;
+					}
+				}
+
+				ret = 0;
+				snprintf(tx_buf, sizeof(tx_buf), "%d:%d", cmd->magic, DRM_OK);
+			} while (0);
+
+			break;
+
+		case CMD_PLANE_STOP:	/* client disconnects */
+			do {
+				/* ring entries not drained yet would turn the plane back on */
+				ring_release(cmd->slot);
+				mailbox_cancel_plane(client->plane_id);
+
+				ret = drmModeSetPlane(fd, client->plane_id,
+						0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+				if (ret) {
+					perror("failed drmModeSetCrtc(restore original)");
+					ret = -1;
+					break;
+				}
+
+				snprintf(tx_buf, sizeof(tx_buf), "%d:%d", cmd->magic, DRM_OK);
+			} while (0);
+
+			break;
+
+		case CMD_RING:	/* map client command ring */
+			do {
+				if (cmd->nfds != 2 || client->ring) {
+					fprintf(stderr, "client %d: bad ring setup request\n", cmd->slot);
+					ret = -1;
+					break;
+				}
+
+				client->ring = drm_ring_map(cmd->fds[0]);
+				if (!client->ring) {
+					ret = -1;
+					break;
+				}
+
+				client->doorbell = cmd->fds[1];
+				kms_fds[POLL_RING(cmd->slot)].fd = cmd->fds[1];
+				kms_fds[POLL_RING(cmd->slot)].events = ring_drain_armed ? 0 : POLLIN;
+
+				/* doorbell is kept, ring memory stays mapped */
+				close(cmd->fds[0]);
+				cmd->nfds = 0;
+
+				ret = 0;
+				snprintf(tx_buf, sizeof(tx_buf), "%d:%d", cmd->magic, DRM_OK);
+			} while (0);
+
+			break;
+
+		case CMD_CURSOR:	/* move hardware cursor on the next vblank */
+			do {
+				/* only on the crtc the client drives or shows its plane on */
+				if (!cmd->crtc_id || cmd->crtc_id != client->crtc_id) {
+					fprintf(stderr, "client %d: cursor on crtc %u it does not own\n", cmd->slot, cmd->crtc_id);
+					ret = -1;
+					break;
+				}
+
+				ret = mailbox_post_cursor(fd, cmd->slot, cmd->crtc_id, (int) cmd->x, (int) cmd->y, cmd->visible != 0);
+				if (ret) {
+					ret = -1;
+					break;
+				}
+
+				snprintf(tx_buf, sizeof(tx_buf), "%d:%d", cmd->magic, DRM_OK);
+			} while (0);
+
+			break;
+
+		case CMD_STATS:	/* report server statistics */
+			do {
+				snprintf(tx_buf, sizeof(tx_buf), "%d:%d:%lu:%lu:%lu:%lu", cmd->magic, DRM_OK,
+					stats.requests, stats.updates, stats.commits, stats.coalesced);
+				ret = 0;
+			} while (0);
+
+			break;
+
+		default:
+			ret = -1;
+	}
+
+	while (cmd->nfds > 0)
+		close(cmd->fds[--cmd->nfds]);
+
+	if (deferred)
+		return;
+
+	if (ret == -1) {
+		bzero(tx_buf, sizeof(tx_buf));
+		snprintf(tx_buf, sizeof(tx_buf), "%d:%d", cmd->magic, DRM_ERROR);
+	}
+
+	fprintf(stdout, "send to client %d response [%s]\n", cmd->slot, tx_buf);
+	write(cmd->sock, tx_buf, sizeof(tx_buf));
+
+	latency_account(cmd->slot, &cmd->ts);
+}
+
+/*
+ * Connector hotplug: re-probe only what the uevent points at and re-apply
+ * configuration of the clients whose connector changed; other outputs are
+ * left alone. Re-applied crtcs go through mailboxes without a client reply.
+ */
+
+#define MAXCONNECTORS	16
+
+static void hotplug_handle(int fd, uint32_t hint)
+{
+	uint32_t changed[MAXCONNECTORS];
+	struct drm_client_info *client;
+	drmModeConnector *connector;
+	struct drm_topology *topo;
+	drmModeModeInfo *mode;
+	struct timespec ts;
+	int i, j, n;
+
+	topo = drm_topology_get(fd);
+	if (!topo)
+		return;
+
+	n = drm_topology_refresh(topo, hint, changed, MAXCONNECTORS);
+	if (n == 0)
+		return;
+
+	if (n < 0 || n > MAXCONNECTORS) {
+		/* new connectors or too many changes: rescan, recheck everything */
+		drm_topology_invalidate();
+		topo = drm_topology_get(fd);
+		if (!topo)
+			return;
+		n = -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	for (i = 0; i < MAXCLIENTS; i++) {
+		client = &drm_clients[i];
+
+		if (client->sock == -1 || !client->conn_id || !client->saved_crtc)
+			continue;
+
+		for (j = 0; j < n; j++)
+			if (changed[j] == client->conn_id)
+				break;
+
+		if (n > 0 && j == n)
+			continue;
+
+		connector = drm_topology_connector(topo, client->conn_id);
+		if (!connector || connector->connection != DRM_MODE_CONNECTED) {
+			fprintf(stdout, "client %d: connector %u unplugged\n", i, client->conn_id);
+			continue;
+		}
+
+		mode = drm_topology_mode(topo, client->conn_id, client->mode_name);
+		if (!mode) {
+			fprintf(stderr, "client %d: mode %s is gone from connector %u\n",
+				i, client->mode_name, client->conn_id);
+			continue;
+		}
+
+		fprintf(stdout, "client %d: connector %u replugged, restore crtc %u\n",
+			i, client->conn_id, client->crtc_id);
+
+		client->mode = *mode;
+		mailbox_post_crtc(fd, -1, 0, &ts, client->crtc_id, client->fb, client->conn_id, &client->mode);
+	}
+}
+
+/* */
+
+static void * kms_thread(void *arg)
+{
+	int fd = *(int *) arg;
+	struct server_cmd cmd;
+	drmEventContext evctx;
+	unsigned long us;
+	uint32_t hint;
+	uint64_t bell;
+	int rc, i;
+
+	kms_fds[POLL_DRM].fd = fd;
+	kms_fds[POLL_DRM].events = POLLIN;
+
+	kms_fds[POLL_QUEUE].fd = queue_bell;
+	kms_fds[POLL_QUEUE].events = POLLIN;
+
+	/* hotplug uevents keep topology cache up to date, run without them if unavailable */
+	kms_fds[POLL_UEVENT].fd = drm_uevent_open();
+	kms_fds[POLL_UEVENT].events = POLLIN;
+
+	for(i = 0; i < MAXCLIENTS; i++) {
+		kms_fds[POLL_RING(i)].fd = -1;
+		kms_fds[POLL_RING(i)].events = POLLIN;
+		bzero(&drm_clients[i], sizeof(struct drm_client_info));
+		drm_clients[i].sock = -1;
+		drm_clients[i].doorbell = -1;
+	}
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.vblank_handler = vblank_handler;
+
+	while (atomic_load(&running)) {
+
+		rc = poll(kms_fds, POLL_KMS_SIZE, 1000);
+
+		if (rc <= 0)
+			continue;
+
+		/* presentation and flush events */
+
+		if (kms_fds[POLL_DRM].revents & POLLIN)
+			drmHandleEvent(fd, &evctx);
+
+		/* connector hotplug */
+
+		if (kms_fds[POLL_UEVENT].revents & POLLIN) {
+			if (drm_uevent_hotplug(kms_fds[POLL_UEVENT].fd, fd, &hint))
+				hotplug_handle(fd, hint);
+		}
+
+		/* decoded requests */
+
+		if (kms_fds[POLL_QUEUE].revents & POLLIN) {
+
+			read(queue_bell, &bell, sizeof(bell));
+
+			while (queue_pop(&cmd)) {
+
+				if (cmd.command != CMD_DISCONNECT) {
+					us = elapsed_us(&cmd.ts);
+					stats.requests++;
+					stats.queue_sum_us += us;
+					if (us > stats.queue_max_us)
+						stats.queue_max_us = us;
+				}
+
+				request_handle(fd, &cmd);
+			}
+		}
+
+		/* ring doorbells: drain all rings on the next vblank */
+
+		for (i = 0; i < MAXCLIENTS; i++) {
+
+			if (kms_fds[POLL_RING(i)].fd == -1)
+				continue;
+
+			if (!(kms_fds[POLL_RING(i)].revents & POLLIN))
+				continue;
+
+			read(kms_fds[POLL_RING(i)].fd, &bell, sizeof(bell));
+
+			if (!ring_drain_armed) {
+				/* the client's CMD_PLANE has set the mailbox up, if any */
+				struct crtc_mailbox *cm = crtc_mailbox_find(drm_clients[i].crtc_id);
+
+				/* no more wakeups until rings are drained by the next flush */
+				ring_drain_armed = true;
+				ring_doorbells_enable(false);
+
+				if (cm)
+					mailbox_arm(fd, cm);
+				else
+					ring_drain(fd);
+			}
+		}
+	}
+
+	if (kms_fds[POLL_UEVENT].fd != -1)
+		close(kms_fds[POLL_UEVENT].fd);
+
+	for (i = 0; i < crtc_mb_count; i++)
+		drm_cursor_fini(&crtc_mb[i].cursor);
+
+	stats_dump();
+
+	/* I/O thread may be waiting for a cell that will never be freed */
+	queue_space_ring();
+
+	return NULL;
+}
+
+/* */
+
 int main(int argc, char *argv[])
 {
 	struct sockaddr_un  cli_addr, serv_addr;
@@ -43,13 +1179,14 @@ int main(int argc, char *argv[])
 
 	int ret, fd, rc, i;
 	struct sigaction act;
+	sigset_t set;
 
-	struct drm_client_info drm_clients[MAXCLIENTS];
-	struct pollfd clients[MAXCLIENTS + 1];			// server socket will be in the last cell
+	struct pollfd clients[POLL_IO_SIZE];	// server socket will be in the last cell
+	pthread_t kms;
 
-	char tx_buf[DRM_SRV_MSGLEN + 1];
 	char rx_buf[DRM_SRV_MSGLEN + 1];
-	uint32_t command, magic;
+	struct server_cmd cmd;
+	uint64_t bell = 1;
 
 	/* setup signal handler */
 
@@ -72,6 +1209,7 @@ int main(int argc, char *argv[])
 
 	if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
 		perror("could not create socket");
+		ret = -1;
 		goto err_close;
 	}
 
@@ -83,25 +1221,58 @@ int main(int argc, char *argv[])
 
 	if (bind(sockfd, (struct sockaddr *)&serv_addr, servlen) < 0) {
 		perror("could not bind socket");
+		ret = -1;
 		goto err_close;
 	}
 
 	listen(sockfd, 5);
 
+	/* start KMS thread: it gets no signals, the I/O thread stops it */
+
+	queue_bell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (queue_bell < 0) {
+		perror("could not create eventfd");
+		ret = -1;
+		goto err_unlink;
+	}
+
+	queue_space = eventfd(0, EFD_CLOEXEC);
+	if (queue_space < 0) {
+		perror("could not create eventfd");
+		close(queue_bell);
+		ret = -1;
+		goto err_unlink;
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	ret = pthread_create(&kms, NULL, kms_thread, &fd);
+
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+	if (ret) {
+		fprintf(stderr, "could not create KMS thread: %s\n", strerror(ret));
+		ret = -1;
+		goto err_bell;
+	}
+
 	/* prepare data structures for clients */
 
-	clients[MAXCLIENTS].fd = sockfd;
-	clients[MAXCLIENTS].events = POLLIN;
+	clients[POLL_SERVER].fd = sockfd;
+	clients[POLL_SERVER].events = POLLIN;
 
 	for(i = 0; i < MAXCLIENTS; i++) {
 		clients[i].fd = -1;
+		atomic_init(&slot_busy[i], false);
 	}
 
 	/* go */
 
 	do {
 
-		rc = poll(clients, MAXCLIENTS + 2, 10000);
+		rc = poll(clients, POLL_IO_SIZE, 10000);
 
 		if(rc == 0){
 			fprintf(stdout, "poll timeout\n");
@@ -120,7 +1291,7 @@ int main(int argc, char *argv[])
 
 		/* new connection */
 
-		if (clients[MAXCLIENTS].revents & POLLIN) {
+		if (clients[POLL_SERVER].revents & POLLIN) {
 
 			clientfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
 			if (clientfd < 0) {
@@ -128,9 +1299,11 @@ int main(int argc, char *argv[])
 				break;
 			}
 
+			/* slot is free once KMS thread has released previous client */
 			for (i = 0; i < MAXCLIENTS; i++) {
 
-				if (clients[i].fd == -1) {
+				if (clients[i].fd == -1 && !atomic_load(&slot_busy[i])) {
+					atomic_store(&slot_busy[i], true);
 					clients[i].fd = clientfd;
 					clients[i].events = POLLIN;
 					break;
@@ -155,196 +1328,49 @@ int main(int argc, char *argv[])
 			if (!(clients[i].revents & (POLLIN | POLLERR)))
 				continue;
 
+			bzero(&cmd, sizeof(cmd));
+			cmd.slot = i;
+			cmd.sock = clients[i].fd;
+
 			bzero(rx_buf, sizeof(rx_buf));
-			ret = read(clients[i].fd, rx_buf, sizeof(rx_buf));
+			ret = drm_recv_msg(clients[i].fd, rx_buf, sizeof(rx_buf), cmd.fds, &cmd.nfds);
 
-			if (ret < 0) {
-				perror("problem with socket");
-				close(clients[i].fd);
-				clients[i].fd = -1;
-				continue;
-			}
+			clock_gettime(CLOCK_MONOTONIC, &cmd.ts);
 
-			if (ret == 0) {
-				fprintf(stdout, "client %d gone,closing connection\n", i);
-				close(clients[i].fd);
+			if (ret <= 0) {
+				if (ret < 0)
+					perror("problem with socket");
+				else
+					fprintf(stdout, "client %d gone,closing connection\n", i);
+
+				/* socket is closed by KMS thread after its last reply */
 				clients[i].fd = -1;
+				cmd.command = CMD_DISCONNECT;
+				queue_push(&cmd);
 				continue;
 			}
 
-			/* handle drm client */
-
-			sscanf(rx_buf, "%d:%d", &magic, &command);
-			fprintf(stdout, "accepted request [%s] -> (%d, %d)\n", rx_buf, magic, command);
-
-			switch (command) {
-				case CMD_AUTH:	/* authenticate client */
-					do {
-						ret = drmAuthMagic(fd, magic);
-
-						if (ret) {
-							perror("failed drmAuthMagic");
-							ret = -1;
-							break;
-						} else {
-							bzero(&drm_clients[i], sizeof(struct drm_client_info));
-							drm_clients[i].magic = magic;
-						}
-
-						bzero(tx_buf, sizeof(tx_buf));
-						snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, DRM_OK);
-					} while (0);
-
-					break;
-
-				case CMD_CRTC:	/* save old crtc and create new crtc */
-					do {
-						drmModeModeInfo *tm;
-						uint32_t a, b;
-
-						sscanf(rx_buf, "%d:%d:%d:%d:%d:%s", &a, &b,
-							&drm_clients[i].crtc_id, &drm_clients[i].conn_id,
-							&drm_clients[i].fb, drm_clients[i].mode_name);
+			/* decode and pass to KMS thread */
 
-						fprintf(stdout, "got req: %d:%d:%d:%d:%d:%s\n", a, b,
-							drm_clients[i].crtc_id, drm_clients[i].conn_id,
-							drm_clients[i].fb, drm_clients[i].mode_name);
-
-						tm = drm_get_mode_by_name(fd, drm_clients[i].conn_id, drm_clients[i].mode_name);
-
-						if (!tm) {
-							perror("failed drm_get_mode_by_name");
-							ret = -1;
-							break;
-						}
-
-						drm_clients[i].mode = tm;
-
-						/* store current crtc */
-
-						drm_clients[i].saved_crtc = drmModeGetCrtc(fd, drm_clients[i].crtc_id);
-						if (drm_clients[i].saved_crtc == NULL) {
-							perror("failed drmModeGetCrtc(current)");
-							ret = -1;
-							break;
-						}
-
-						dump_crtc_configuration("saved_crtc", drm_clients[i].saved_crtc);
-
-						/* setup new crtc */
-
-						ret = drmModeSetCrtc(fd, drm_clients[i].crtc_id, drm_clients[i].fb, 0, 0,
-								&drm_clients[i].conn_id, 1, drm_clients[i].mode);
-
-						if (ret) {
-							perror("failed drmModeSetCrtc(new)");
-							ret = -1;
-							break;
-						}
-
-						drm_clients[i].current_crtc = drmModeGetCrtc(fd, drm_clients[i].crtc_id);
-
-						if (drm_clients[i].current_crtc != NULL) {
-							dump_crtc_configuration("current_crtc", drm_clients[i].current_crtc);
-						} else {
-							perror("failed drmModeGetCrtc(new)");
-							ret = -1;
-							break;
-						}
-
-						bzero(tx_buf, sizeof(tx_buf));
-						snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, DRM_OK);
-					} while (0);
-
-					break;
+			request_decode(rx_buf, &cmd);
+			queue_push(&cmd);
 
-				case CMD_PLANE:	/* setup plane */
-					do {
-						uint32_t a, b;
-
-						sscanf(rx_buf, "%d:%d:%d:%d:%d:%d:%d:%d:%d", &a, &b,
-							&drm_clients[i].crtc_id, &drm_clients[i].plane_id, &drm_clients[i].fb,
-							&drm_clients[i].w, &drm_clients[i].h, &drm_clients[i].x, &drm_clients[i].y);
-
-						fprintf(stdout, "got req: %d:%d:%d:%d:%d:%d:%d:%d:%d\n", a, b,
-							drm_clients[i].crtc_id, drm_clients[i].plane_id, drm_clients[i].fb,
-							drm_clients[i].w, drm_clients[i].h, drm_clients[i].x, drm_clients[i].y);
-
-						ret = drmModeSetPlane(fd, drm_clients[i].plane_id, drm_clients[i].crtc_id,
-								drm_clients[i].fb, 0, drm_clients[i].x, drm_clients[i].y,
-								drm_clients[i].w, drm_clients[i].h, 0, 0,
-								drm_clients[i].w << 16, drm_clients[i].h << 16);
-
-						if (ret) {
-							perror("cannot set plane");
-							ret = -1;
-							break;
-						}
-
-						bzero(tx_buf, sizeof(tx_buf));
-						snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, DRM_OK);
-					} while (0);
-
-					break;
-
-				case CMD_CRTC_STOP:	/* client disconnects */
-					do {
-
-						if (drm_clients[i].saved_crtc->mode_valid) {
-							ret = drmModeSetCrtc(fd, drm_clients[i].saved_crtc->crtc_id,
-									drm_clients[i].saved_crtc->buffer_id,
-									drm_clients[i].saved_crtc->x, drm_clients[i].saved_crtc->y,
-									&(drm_clients[i].conn_id), 1, &(drm_clients[i].saved_crtc->mode));
-
-							if (ret) {
-								perror("failed drmModeSetCrtc(restore original)");
-								ret = -1;
-								break;
-							}
-						}
-
-						bzero(tx_buf, sizeof(tx_buf));
-						snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, DRM_OK);
-					} while (0);
-
-					break;
-
-				case CMD_PLANE_STOP:	/* client disconnects */
-					do {
-
-
-						ret = drmModeSetPlane(fd, drm_clients[i].plane_id,
-								0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
-
-						if (ret) {
-							perror("failed drmModeSetCrtc(restore original)");
-							ret = -1;
-							break;
-						}
-
-						bzero(tx_buf, sizeof(tx_buf));
-						snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, DRM_OK);
-					} while (0);
-
-					break;
-
-				default:
-					ret = -1;
-			}
+			if (--rc == 0) break;
+		}
 
-			if (ret == -1) {
-				bzero(tx_buf, sizeof(tx_buf));
-				snprintf(tx_buf, sizeof(tx_buf), "%d:%d", magic, DRM_ERROR);
-			}
+	} while (atomic_load(&running));
 
-			fprintf(stdout, "send to client %d response [%s]\n", i, tx_buf);
-			write(clients[i].fd, tx_buf, sizeof(tx_buf));
+	atomic_store(&running, false);
+	write(queue_bell, &bell, sizeof(bell));
+	pthread_join(kms, NULL);
 
-			if (--rc == 0) break;
-		}
+	ret = 0;
 
-	} while (running);
+err_bell:
+	close(queue_space);
+	close(queue_bell);
 
+err_unlink:
 	close(sockfd);
 	unlink(DRM_SERVER_NAME);
 
@@ -356,5 +1382,5 @@ err_close:
 
 void int_handler(int signo)
 {
-	running  = false;
+	atomic_store(&running, false);
 }
@@ -18,127 +18,175 @@
 
 #include "drm_utils.h"
 
+/* connector query mode and startup timing */
+
+static bool drm_probe = true;
+
+static struct timespec drm_start_ts;
+static double drm_probe_ms;
+
+static void drm_timing_start(void)
+{
+	if (drm_start_ts.tv_sec == 0 && drm_start_ts.tv_nsec == 0)
+		clock_gettime(CLOCK_MONOTONIC, &drm_start_ts);
+}
+
+static double drm_elapsed_ms(struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000.0 + (now.tv_nsec - ts->tv_nsec) / 1000000.0;
+}
+
+void drm_set_probe(bool probe)
+{
+	if (probe != drm_probe)
+		drm_topology_invalidate();
+
+	drm_probe = probe;
+}
+
+/*
+ * drmModeGetConnector makes the kernel re-probe the connector (DDC/EDID reads,
+ * load detection), which costs tens of milliseconds per HDMI/DP port.
+ * drmModeGetConnectorCurrent returns what the kernel already knows; a
+ * connector which has not been probed yet has no modes and an unknown
+ * status, so only those are probed for real.
+ */
+
+static drmModeConnector * drm_get_connector_current(int fd, uint32_t connector_id)
+{
+	drmModeConnector *connector;
+
+	connector = drmModeGetConnectorCurrent(fd, connector_id);
+	if (connector && (connector->count_modes > 0 || connector->connection == DRM_MODE_DISCONNECTED))
+		return connector;
+
+	drmModeFreeConnector(connector);
+	return NULL;
+}
+
+drmModeConnector * drm_get_connector(int fd, uint32_t connector_id)
+{
+	drmModeConnector *connector;
+
+	if (!drm_probe) {
+		connector = drm_get_connector_current(fd, connector_id);
+		if (connector)
+			return connector;
+	}
+
+	return drmModeGetConnector(fd, connector_id);
+}
+
+/*
+ * Full probes are not run in parallel: the kernel holds mode_config.mutex
+ * for the whole GetConnector probe, so probes of one device run one after
+ * another whatever the number of callers. The only saving is to skip the
+ * probe of connectors whose current state is already known.
+ */
+
+static void drm_probe_connectors(int fd, uint32_t *ids, drmModeConnector **connectors, int count, bool probe)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		connectors[i] = probe ? NULL : drm_get_connector_current(fd, ids[i]);
+		if (!connectors[i])
+			connectors[i] = drmModeGetConnector(fd, ids[i]);
+	}
+}
+
+void drm_report_first_modeset(void)
+{
+	static bool reported = false;
+
+	if (reported || (drm_start_ts.tv_sec == 0 && drm_start_ts.tv_nsec == 0))
+		return;
+
+	reported = true;
+
+	printf("first modeset after %.1f ms, connector query %.1f ms (%s)\n",
+		drm_elapsed_ms(&drm_start_ts), drm_probe_ms, drm_probe ? "full probe" : "current state");
+}
+
 /* */
 
 static void drm_cmdline_usage(char *name)
 {
-	printf("usage: %s [-h] -c <connector> -e <encoder> -m <mode>\n", name);
+	printf("usage: %s [-h] [-q] -c <connector> -e <encoder> -m <mode>\n", name);
 	printf("\t-h: this help message\n");
+	printf("\t-q			use current connector state, don't probe\n");
 	printf("\t-n <connector>	connector id, default is 0\n");
 	printf("\t-e <encoder>		encoder id, default is 0\n");
 	printf("\t-c <crtc>			crtc id, default is 0\n");
 	printf("\t-m <mode>			mode name, default is 'preferred'\n");
 }
 
-bool drm_get_conf_cmdline(int fd, struct kms_display *kms, int argc, char *argv[])
+/* explicit configuration: zero connector, encoder and crtc ids select autoconfiguration */
+
+bool drm_get_conf(int fd, struct kms_display *kms, uint32_t nid, uint32_t eid, uint32_t cid, char *mode_name)
 {
 	drmModeConnector *connector;
 	drmModeEncoder *encoder;
 	drmModeCrtc *crtc;
 
-    drmModeRes *resources;
+	struct drm_topology *topo;
 	drmModeModeInfo *mode;
 
-	int opt, i;
+	drm_timing_start();
 
-	char *mode_name = PREFERRED_MODE;
+	if (!mode_name)
+		mode_name = PREFERRED_MODE;
 
-	int cid = 0;
-	int eid = 0;
-	int nid = 0;
+	/* no objects given: pick them automatically, keep the requested mode */
+	if (!nid && !eid && !cid) {
+		if (!drm_autoconf(fd, kms))
+			return false;
 
-	while ((opt = getopt(argc, argv, "n:c:e:m:h")) != -1) {
-		switch (opt) {
-			case 'm':
-				mode_name = strdup(optarg);
-				break;
-			case 'n':
-				nid = atoi(optarg);
-				break;
-			case 'c':
-				cid = atoi(optarg);
-				break;
-			case 'e':
-				eid = atoi(optarg);
-				break;
-			case 'h':
-			default:
-				drm_cmdline_usage(argv[0]);
-				exit(0);
-		}
+		mode = drm_get_mode_by_name(fd, kms->connector->connector_id, mode_name);
+		if (!mode)
+			return false;
+
+		kms->mode = mode;
+		return true;
 	}
 
-	resources = drmModeGetResources(fd);
-	if (!resources) {
-		fprintf(stderr, "drmModeGetResources failed\n");
+	topo = drm_topology_get(fd);
+	if (!topo)
 		return false;
-	}
 
     /* find connector */
 
-	for (i = 0; i < resources->count_connectors; i++) {
-		connector = drmModeGetConnector(fd, resources->connectors[i]);
-		if (!connector)
-			continue;
-
-		if (nid == connector->connector_id)
-			break;
-
-		drmModeFreeConnector(connector);
-	}
-
-	if (i == resources->count_connectors) {
+	connector = drm_topology_connector(topo, nid);
+	if (!connector) {
 		fprintf(stderr, "Connector with id = %d does not exist\n", nid);
-		goto no_connector;
+		return false;
 	}
 
     /* find encoder */
 
-	for (i = 0; i < resources->count_encoders; i++) {
-		encoder = drmModeGetEncoder(fd, resources->encoders[i]);
-		if (!encoder)
-			continue;
-
-		if (eid == encoder->encoder_id)
-			break;
-
-		drmModeFreeEncoder(encoder);
-	}
-
-	if (i == resources->count_encoders) {
+	encoder = drm_topology_encoder(topo, eid);
+	if (!encoder) {
 		fprintf(stderr, "Encoder with id = %d does not exist\n", eid);
-		goto no_encoder;
+		return false;
     }
 
     /* find mode */
 
-    for (i = 0, mode = connector->modes; i < connector->count_modes; i++, mode++) {
-        if (0 == strcmp(mode->name, mode_name))
-            break;
-    }
-
-	if (i == connector->count_modes) {
+	mode = drm_topology_mode(topo, connector->connector_id, mode_name);
+	if (!mode) {
 		fprintf(stderr, "Mode with name %s does not exist\n", mode_name);
-		goto no_mode;
+		return false;
     }
 
     /* find crtc */
 
-    for (i = 0; i < resources->count_crtcs; i++) {
-        crtc = drmModeGetCrtc(fd, resources->crtcs[i]);
-
-        if (!crtc)
-            continue;
-
-        if (cid == crtc->crtc_id)
-            break;
-
-        drmModeFreeCrtc(crtc);
-    }
-
-	if (i == resources->count_crtcs) {
+	crtc = drm_topology_crtc(topo, cid);
+	if (!crtc) {
 		fprintf(stderr, "Crtc with id = %d does not exist\n", cid);
-		goto no_crtc;
+		return false;
     }
 
     /* */
@@ -148,15 +196,46 @@ bool drm_get_conf_cmdline(int fd, struct kms_display *kms, int argc, char *argv[
     kms->crtc = crtc;
 	kms->mode = mode;
 
-	drmModeFreeResources(resources);
 	return true;
+}
+
+bool drm_get_conf_cmdline(int fd, struct kms_display *kms, int argc, char *argv[])
+{
+	char *mode_name = PREFERRED_MODE;
+
+	int opt;
+
+	int cid = 0;
+	int eid = 0;
+	int nid = 0;
+
+	while ((opt = getopt(argc, argv, "n:c:e:m:qh")) != -1) {
+		switch (opt) {
+			case 'q':
+				drm_set_probe(false);
+				break;
+			case 'm':
+				mode_name = optarg;
+				break;
+			case 'n':
+				nid = atoi(optarg);
+				break;
+			case 'c':
+				cid = atoi(optarg);
+				break;
+			case 'e':
+				eid = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				drm_cmdline_usage(argv[0]);
+				exit(0);
+		}
+	}
+
+	if (drm_get_conf(fd, kms, nid, eid, cid, mode_name))
+		return true;
 
-no_crtc:
-no_mode:
-	drmModeFreeEncoder(encoder);
-no_encoder:
-	drmModeFreeConnector(connector);
-no_connector:
 	drm_cmdline_usage(argv[0]);
 	return false;
 }
@@ -167,93 +246,70 @@ bool drm_autoconf(int fd, struct kms_display *kms)
 	drmModeConnector *connector;
 	drmModeEncoder *encoder;
 	drmModeCrtc *crtc;
-	drmModeCrtc *c;
 
-    drmModeRes *resources;
+	struct drm_topology *topo;
 	drmModeModeInfo *mode;
 
 	int i;
 
-	resources = drmModeGetResources(fd);
-	if (!resources) {
-		fprintf(stderr, "drmModeGetResources failed\n");
+	drm_timing_start();
+
+	topo = drm_topology_get(fd);
+	if (!topo)
 		return false;
-	}
 
     /* find connected connector */
 
-	for (i = 0; i < resources->count_connectors; i++) {
-		connector = drmModeGetConnector(fd, resources->connectors[i]);
+	for (i = 0; i < topo->resources->count_connectors; i++) {
+		connector = topo->connectors[i];
 		if (!connector)
 			continue;
 
 		if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
 			break;
-
-		drmModeFreeConnector(connector);
 	}
 
-	if (i == resources->count_connectors) {
+	if (i == topo->resources->count_connectors) {
 		fprintf(stderr, "No currently active connector found\n");
 		return false;
 	}
 
     /* find appropriate encoder */
 
-	for (i = 0; i < resources->count_encoders; i++) {
-		encoder = drmModeGetEncoder(fd, resources->encoders[i]);
-
-		if (!encoder)
-			continue;
-
-		if (encoder->encoder_id == connector->encoder_id)
-			break;
-
-		drmModeFreeEncoder(encoder);
-	}
-
-	if (i == resources->count_encoders) {
+	encoder = drm_topology_encoder(topo, connector->encoder_id);
+	if (!encoder) {
         fprintf(stderr, "No matching encoder for connector, use the first supported encoder\n");
-        encoder = drmModeGetEncoder(fd, connector->encoders[0]);
+
+        if (connector->count_encoders > 0)
+            encoder = drm_topology_encoder(topo, connector->encoders[0]);
 
         if (!encoder) {
             fprintf(stderr, "Can't get preferred encoders\n");
-            goto drm_free_connector;
+            return false;
         }
     }
 
     /* select preferred mode */
 
-    for (i = 0, mode = connector->modes; i < connector->count_modes; i++, mode++) {
-        if (0 == strcmp(mode->name, "preferred"))
-            break;
-    }
-
-	if (i == connector->count_modes) {
-        fprintf(stderr, "No preferred mode, choose the first available mode\n");
-        mode = connector->modes;
-    }
+    mode = drm_topology_mode(topo, connector->connector_id, PREFERRED_MODE);
 
     /* find crtc */
 
-    c = NULL;
-
-    for (i = 0; i < resources->count_crtcs; i++) {
-        crtc = drmModeGetCrtc(fd, resources->crtcs[i]);
-
-        if (!crtc)
-            continue;
-
-        if (crtc->crtc_id == encoder->crtc_id)
-            break;
+	crtc = drm_topology_crtc(topo, encoder->crtc_id);
+	if (!crtc) {
+        fprintf(stderr, "No crtc for encoder, choose the first possible crtc\n");
 
-        if (!c && (encoder->possible_crtcs & (1 << i)))
-            c = crtc;
-    }
+        for (i = 0; i < topo->resources->count_crtcs; i++) {
+            if ((encoder->possible_crtcs & (1 << i)) && topo->crtcs[i]) {
+                crtc = topo->crtcs[i];
+                break;
+            }
+        }
 
-	if (i == resources->count_crtcs) {
-        fprintf(stderr, "No crtc for encoder, choose the first possible crtc\n");
-        crtc = c;
+        if (!crtc) {
+            fprintf(stderr, "No possible crtc for encoder\n");
+            return false;
+        }
     }
 
     /* */
@@ -263,62 +319,102 @@ bool drm_autoconf(int fd, struct kms_display *kms)
     kms->crtc = crtc;
 	kms->mode = mode;
 
-	drmModeFreeResources(resources);
 	return true;
-
-drm_free_connector:
-	drmModeFreeConnector(connector);
-
-	return false;
 }
 
-drmModeModeInfo * drm_get_mode_by_name(int fd, uint32_t connector_id, char *mode_name)
+/*
+ * Multi-head autoconfiguration: every connected connector gets its own crtc.
+ * Current routing is kept when possible, otherwise the first free crtc any
+ * of the connector encoders can drive is taken. Connectors which can not
+ * get a crtc are skipped. Returns the number of configured outputs.
+ */
+
+int drm_autoconf_all(int fd, struct kms_display *kms, int max)
 {
 	drmModeConnector *connector;
-    drmModeRes *resources;
-	drmModeModeInfo *mode;
+	drmModeEncoder *encoder;
+	drmModeCrtc *crtc;
 
-	int i;
+	struct drm_topology *topo;
+	uint32_t used = 0;
+	int i, j, k, n = 0;
 
-	resources = drmModeGetResources(fd);
-	if (!resources) {
-		fprintf(stderr, "drmModeGetResources failed\n");
-		return NULL;
-	}
+	drm_timing_start();
 
-    /* find connected connector */
+	topo = drm_topology_get(fd);
+	if (!topo)
+		return -1;
 
-	for (i = 0; i < resources->count_connectors; i++) {
-		connector = drmModeGetConnector(fd, resources->connectors[i]);
+	for (i = 0; i < topo->resources->count_connectors && n < max; i++) {
+		connector = topo->connectors[i];
 		if (!connector)
 			continue;
 
-		if (connector->connector_id == connector_id)
-			break;
+		if (connector->connection != DRM_MODE_CONNECTED || connector->count_modes == 0)
+			continue;
 
-		drmModeFreeConnector(connector);
-	}
+		crtc = NULL;
 
-	if (i == resources->count_connectors) {
-		fprintf(stderr, "No proper connector found\n");
-		drmModeFreeResources(resources);
-		return NULL;
+		/* keep current routing if its crtc is still free */
+
+		encoder = drm_topology_encoder(topo, connector->encoder_id);
+		if (encoder) {
+			k = drm_topology_index(topo, encoder->crtc_id, DRM_MODE_OBJECT_CRTC);
+			if (k >= 0 && !(used & (1 << k)))
+				crtc = topo->crtcs[k];
+		}
+
+		for (j = 0; !crtc && j < connector->count_encoders; j++) {
+			encoder = drm_topology_encoder(topo, connector->encoders[j]);
+			if (!encoder)
+				continue;
+
+			for (k = 0; k < topo->resources->count_crtcs; k++) {
+				if ((encoder->possible_crtcs & (1 << k)) && !(used & (1 << k)) && topo->crtcs[k]) {
+					crtc = topo->crtcs[k];
+					break;
+				}
+			}
+		}
+
+		if (!crtc) {
+			fprintf(stderr, "No free crtc for connector %u, skip it\n", connector->connector_id);
+			continue;
+		}
+
+		used |= 1 << drm_topology_index(topo, crtc->crtc_id, DRM_MODE_OBJECT_CRTC);
+
+		kms[n].connector = connector;
+		kms[n].encoder = encoder;
+		kms[n].crtc = crtc;
+		kms[n].mode = drm_topology_mode(topo, connector->connector_id, PREFERRED_MODE);
+		n++;
 	}
 
-    /* find mode by name */
+	if (n == 0)
+		fprintf(stderr, "No currently active connector found\n");
+
+	return n;
+}
 
-    for (i = 0, mode = connector->modes; i < connector->count_modes; i++, mode++) {
-        if (0 == strcmp(mode->name, mode_name))
-            break;
-    }
+drmModeModeInfo * drm_get_mode_by_name(int fd, uint32_t connector_id, char *mode_name)
+{
+	struct drm_topology *topo;
+	drmModeModeInfo *mode;
 
-	if (i == connector->count_modes) {
-        fprintf(stderr, "No selected mode\n");
-		drmModeFreeConnector(connector);
+	topo = drm_topology_get(fd);
+	if (!topo)
 		return NULL;
-    }
 
-	drmModeFreeResources(resources);
+	if (!drm_topology_connector(topo, connector_id)) {
+		fprintf(stderr, "No proper connector found\n");
+		return NULL;
+	}
+
+	mode = drm_topology_mode(topo, connector_id, mode_name);
+	if (!mode)
+		fprintf(stderr, "No selected mode\n");
+
 	return mode;
 }
 
@@ -335,3 +431,1399 @@ void dump_crtc_configuration(char *msg, drmModeCrtc *crtc)
     printf("%d\t%d\t(%d,%d)\t(%dx%d) mode[%s]\n", crtc->crtc_id, crtc->buffer_id,
             crtc->x, crtc->y, crtc->width, crtc->height, crtc->mode.name);
 }
+
+int drm_get_crtc_index(int fd, uint32_t crtc_id)
+{
+	struct drm_topology *topo;
+
+	topo = drm_topology_get(fd);
+	if (!topo)
+		return -1;
+
+	return drm_topology_index(topo, crtc_id, DRM_MODE_OBJECT_CRTC);
+}
+
+/*
+ * Request a vblank event for the next vblank on crtc: legacy SetCrtc/SetPlane
+ * do not deliver completion events, so the first vblank after the commit is
+ * the earliest moment new content can be on the screen. The event is reported
+ * by drmHandleEvent to vblank_handler with 'data' as user_data.
+ */
+
+int drm_queue_vblank_event(int fd, uint32_t crtc_id, void *data)
+{
+	drmVBlank vbl;
+	int pipe;
+
+	pipe = drm_get_crtc_index(fd, crtc_id);
+	if (pipe < 0)
+		return -1;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+	vbl.request.sequence = 1;
+	vbl.request.signal = (unsigned long) data;
+
+	if (pipe == 1)
+		vbl.request.type |= DRM_VBLANK_SECONDARY;
+	else if (pipe > 1)
+		vbl.request.type |= (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+
+	return drmWaitVBlank(fd, &vbl);
+}
+
+
+/*
+ * Async page flips replace the scanout buffer right away instead of at the
+ * next vblank: lower latency at the cost of tearing. Legacy and atomic
+ * flavours are reported by different caps.
+ */
+
+bool drm_async_flip_supported(int fd, bool atomic)
+{
+	uint64_t cap = 0;
+
+	if (drmGetCap(fd, atomic ? DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP : DRM_CAP_ASYNC_PAGE_FLIP, &cap))
+		return false;
+
+	return cap != 0;
+}
+
+/* frame timing statistics, in milliseconds */
+
+void drm_time_stats_add(struct drm_time_stats *stats, double ms)
+{
+	if (!stats->count || ms < stats->min)
+		stats->min = ms;
+
+	if (!stats->count || ms > stats->max)
+		stats->max = ms;
+
+	stats->sum += ms;
+	stats->count++;
+}
+
+void drm_time_stats_dump(struct drm_time_stats *stats, const char *label)
+{
+	if (!stats->count) {
+		printf("%s: no samples\n", label);
+		return;
+	}
+
+	printf("%s: avg %.2f ms, min %.2f ms, max %.2f ms over %lu samples\n",
+		label, stats->sum / stats->count, stats->min, stats->max, stats->count);
+}
+
+/* seconds since 'from', CLOCK_MONOTONIC */
+
+double drm_elapsed(struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from->tv_sec) + (now.tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
+/* summary of a frame loop that ran for 'seconds' with up to 'depth' frames in flight */
+
+void drm_frame_stats_dump(struct drm_frame_stats *stats, double seconds, int depth, bool fenced, const char *api)
+{
+	char label[64];
+
+	if (!stats->frames || seconds <= 0.0)
+		return;
+
+	printf("%d frames in %.2f s: %.1f fps, depth %d, %.2f frames in flight on average\n",
+		stats->frames, seconds, stats->frames / seconds, depth,
+		(double) stats->inflight / stats->frames);
+	printf("cpu busy %.1f%%, blocked on buffers %.1f%%, cpu/gpu overlap in %d of %d frames (%s)\n",
+		100.0 * stats->cpu_busy / seconds, 100.0 * stats->blocked / seconds,
+		stats->overlapped, stats->frames, fenced ? "fenced" : "glFinish");
+
+	/* same run with -A gl and -A gles compares the client APIs on one driver */
+	snprintf(label, sizeof(label), "%s render time (%s)", api, fenced ? "submit, fenced" : "until glFinish");
+	drm_time_stats_dump(&stats->render, label);
+}
+
+/* event timestamps are CLOCK_MONOTONIC (DRM_CAP_TIMESTAMP_MONOTONIC) */
+
+double drm_event_ms(struct timespec *from, unsigned int sec, unsigned int usec)
+{
+	return ((double) sec - from->tv_sec) * 1000.0 + ((double) usec * 1000.0 - from->tv_nsec) / 1000000.0;
+}
+
+/* topology cache */
+
+static struct drm_topology *topology = NULL;
+
+static uint32_t drm_hash_size(int count)
+{
+	uint32_t size = 16;
+
+	while (size < 2 * count)
+		size <<= 1;
+
+	return size;
+}
+
+static uint32_t drm_hash_id(uint32_t id)
+{
+	return id * 2654435761u;
+}
+
+static uint32_t drm_hash_mode(uint32_t connector_id, const char *name)
+{
+	uint32_t h = 2166136261u ^ connector_id;
+
+	while (*name) {
+		h ^= (uint8_t) *name++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static void drm_topology_add_id(struct drm_topology *topo, uint32_t id, uint32_t type, int index)
+{
+	uint32_t h = drm_hash_id(id) & topo->ids_mask;
+
+	while (topo->ids[h].id && topo->ids[h].id != id)
+		h = (h + 1) & topo->ids_mask;
+
+	topo->ids[h].id = id;
+	topo->ids[h].type = type;
+	topo->ids[h].index = index;
+}
+
+static void drm_topology_add_mode(struct drm_topology *topo, uint32_t connector_id,
+		const char *name, drmModeModeInfo *mode)
+{
+	uint32_t h = drm_hash_mode(connector_id, name) & topo->modes_mask;
+
+	while (topo->modes[h].connector_id) {
+		/* several modes may share a name: the first one wins */
+		if (topo->modes[h].connector_id == connector_id && !strcmp(topo->modes[h].name, name))
+			return;
+
+		h = (h + 1) & topo->modes_mask;
+	}
+
+	topo->modes[h].connector_id = connector_id;
+	topo->modes[h].name = name;
+	topo->modes[h].mode = mode;
+}
+
+static void drm_topology_index_connector(struct drm_topology *topo, drmModeConnector *connector)
+{
+	drmModeModeInfo *preferred = NULL;
+	int i;
+
+	for (i = 0; i < connector->count_modes; i++) {
+		drm_topology_add_mode(topo, connector->connector_id, connector->modes[i].name, &connector->modes[i]);
+
+		if (!preferred && (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED))
+			preferred = &connector->modes[i];
+	}
+
+	/* PREFERRED_MODE alias: preferred mode or the first available one */
+
+	if (!preferred && connector->count_modes > 0)
+		preferred = &connector->modes[0];
+
+	if (preferred)
+		drm_topology_add_mode(topo, connector->connector_id, PREFERRED_MODE, preferred);
+}
+
+/* (re)build mode index: needed whenever a connector and its mode list is replaced */
+
+static bool drm_topology_index_modes(struct drm_topology *topo)
+{
+	struct drm_topology_mode *modes;
+	int i, count_modes;
+	uint32_t size;
+
+	for (i = 0, count_modes = 0; i < topo->resources->count_connectors; i++) {
+		if (topo->connectors[i])
+			count_modes += topo->connectors[i]->count_modes + 1;
+	}
+
+	size = drm_hash_size(count_modes);
+	modes = calloc(size, sizeof(struct drm_topology_mode));
+	if (!modes)
+		return false;
+
+	free(topo->modes);
+	topo->modes = modes;
+	topo->modes_mask = size - 1;
+
+	for (i = 0; i < topo->resources->count_connectors; i++) {
+		if (topo->connectors[i])
+			drm_topology_index_connector(topo, topo->connectors[i]);
+	}
+
+	return true;
+}
+
+static void drm_topology_free(struct drm_topology *topo)
+{
+	int i;
+
+	if (topo->resources) {
+		for (i = 0; i < topo->resources->count_connectors; i++)
+			if (topo->connectors[i])
+				drmModeFreeConnector(topo->connectors[i]);
+
+		for (i = 0; i < topo->resources->count_encoders; i++)
+			if (topo->encoders[i])
+				drmModeFreeEncoder(topo->encoders[i]);
+
+		for (i = 0; i < topo->resources->count_crtcs; i++)
+			if (topo->crtcs[i])
+				drmModeFreeCrtc(topo->crtcs[i]);
+
+		drmModeFreeResources(topo->resources);
+	}
+
+	for (i = 0; i < topo->count_planes; i++)
+		if (topo->planes[i])
+			drmModeFreePlane(topo->planes[i]);
+
+	if (topo->plane_resources)
+		drmModeFreePlaneResources(topo->plane_resources);
+
+	free(topo->connectors);
+	free(topo->encoders);
+	free(topo->crtcs);
+	free(topo->planes);
+	free(topo->ids);
+	free(topo->modes);
+	free(topo);
+}
+
+static struct drm_topology * drm_topology_create(int fd)
+{
+	struct drm_topology *topo;
+	drmModeRes *res;
+	struct timespec ts;
+	uint32_t size;
+	int i;
+
+	topo = calloc(1, sizeof(*topo));
+	if (!topo)
+		return NULL;
+
+	topo->fd = fd;
+
+	topo->resources = drmModeGetResources(fd);
+	if (!topo->resources) {
+		fprintf(stderr, "drmModeGetResources failed\n");
+		goto err_free;
+	}
+
+	res = topo->resources;
+
+	/* planes are optional: old kernels and drivers do not expose them */
+
+	topo->plane_resources = drmModeGetPlaneResources(fd);
+	if (topo->plane_resources)
+		topo->count_planes = topo->plane_resources->count_planes;
+
+	topo->connectors = calloc(res->count_connectors + 1, sizeof(drmModeConnector *));
+	topo->encoders = calloc(res->count_encoders + 1, sizeof(drmModeEncoder *));
+	topo->crtcs = calloc(res->count_crtcs + 1, sizeof(drmModeCrtc *));
+	topo->planes = calloc(topo->count_planes + 1, sizeof(drmModePlane *));
+
+	if (!topo->connectors || !topo->encoders || !topo->crtcs || !topo->planes)
+		goto err_free;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	drm_probe_connectors(fd, res->connectors, topo->connectors, res->count_connectors, drm_probe);
+
+	drm_probe_ms = drm_elapsed_ms(&ts);
+
+	for (i = 0; i < res->count_encoders; i++)
+		topo->encoders[i] = drmModeGetEncoder(fd, res->encoders[i]);
+
+	for (i = 0; i < res->count_crtcs; i++)
+		topo->crtcs[i] = drmModeGetCrtc(fd, res->crtcs[i]);
+
+	for (i = 0; i < topo->count_planes; i++)
+		topo->planes[i] = drmModeGetPlane(fd, topo->plane_resources->planes[i]);
+
+	/* build indices */
+
+	size = drm_hash_size(res->count_connectors + res->count_encoders + res->count_crtcs + topo->count_planes);
+	topo->ids = calloc(size, sizeof(struct drm_topology_id));
+	topo->ids_mask = size - 1;
+
+	if (!topo->ids || !drm_topology_index_modes(topo))
+		goto err_free;
+
+	for (i = 0; i < res->count_connectors; i++)
+		if (topo->connectors[i])
+			drm_topology_add_id(topo, res->connectors[i], DRM_MODE_OBJECT_CONNECTOR, i);
+
+	for (i = 0; i < res->count_encoders; i++)
+		if (topo->encoders[i])
+			drm_topology_add_id(topo, res->encoders[i], DRM_MODE_OBJECT_ENCODER, i);
+
+	/* crtc index is its pipe: keep it even if the crtc can't be queried */
+	for (i = 0; i < res->count_crtcs; i++)
+		drm_topology_add_id(topo, res->crtcs[i], DRM_MODE_OBJECT_CRTC, i);
+
+	for (i = 0; i < topo->count_planes; i++)
+		if (topo->planes[i])
+			drm_topology_add_id(topo, topo->plane_resources->planes[i], DRM_MODE_OBJECT_PLANE, i);
+
+	return topo;
+
+err_free:
+	drm_topology_free(topo);
+	return NULL;
+}
+
+struct drm_topology * drm_topology_get(int fd)
+{
+	if (topology && topology->fd == fd)
+		return topology;
+
+	drm_topology_invalidate();
+
+	topology = drm_topology_create(fd);
+	return topology;
+}
+
+void drm_topology_invalidate(void)
+{
+	if (!topology)
+		return;
+
+	drm_topology_free(topology);
+	topology = NULL;
+}
+
+static bool drm_connector_changed(drmModeConnector *a, drmModeConnector *b)
+{
+	if (!a || !b)
+		return a != b;
+
+	return a->connection != b->connection || a->encoder_id != b->encoder_id ||
+		a->count_modes != b->count_modes ||
+		memcmp(a->modes, b->modes, a->count_modes * sizeof(drmModeModeInfo));
+}
+
+/*
+ * Hotplug: re-probe one connector (or all of them when the uevent does not
+ * say which one changed) and replace only those whose state differs.
+ * Ids of the replaced connectors are stored in 'changed'. Connector and
+ * mode pointers taken from the cache before are stale for those ids only.
+ */
+
+int drm_topology_refresh(struct drm_topology *topo, uint32_t connector_id, uint32_t *changed, int max)
+{
+	drmModeRes *res = topo->resources;
+	drmModeConnector **fresh;
+	int i, n = 0;
+
+	if (connector_id) {
+		for (i = 0; i < res->count_connectors; i++)
+			if (res->connectors[i] == connector_id)
+				break;
+
+		/* unknown connector (e.g. new DP MST port): resources changed too */
+		if (i == res->count_connectors)
+			return -1;
+	}
+
+	fresh = calloc(res->count_connectors + 1, sizeof(drmModeConnector *));
+	if (!fresh)
+		return -1;
+
+	if (connector_id) {
+		for (i = 0; i < res->count_connectors; i++)
+			if (res->connectors[i] == connector_id)
+				fresh[i] = drmModeGetConnector(topo->fd, connector_id);
+	} else {
+		drm_probe_connectors(topo->fd, res->connectors, fresh, res->count_connectors, true);
+	}
+
+	for (i = 0; i < res->count_connectors; i++) {
+		if (connector_id && res->connectors[i] != connector_id)
+			continue;
+
+		if (!drm_connector_changed(topo->connectors[i], fresh[i])) {
+			drmModeFreeConnector(fresh[i]);
+			continue;
+		}
+
+		drmModeFreeConnector(topo->connectors[i]);
+		topo->connectors[i] = fresh[i];
+
+		if (fresh[i])
+			drm_topology_add_id(topo, res->connectors[i], DRM_MODE_OBJECT_CONNECTOR, i);
+
+		if (n < max)
+			changed[n] = res->connectors[i];
+		n++;
+	}
+
+	free(fresh);
+
+	if (n == 0)
+		return 0;
+
+	/* routing may have changed along with the connectors */
+
+	for (i = 0; i < res->count_encoders; i++) {
+		if (topo->encoders[i])
+			drmModeFreeEncoder(topo->encoders[i]);
+
+		topo->encoders[i] = drmModeGetEncoder(topo->fd, res->encoders[i]);
+		if (topo->encoders[i])
+			drm_topology_add_id(topo, res->encoders[i], DRM_MODE_OBJECT_ENCODER, i);
+	}
+
+	if (!drm_topology_index_modes(topo)) {
+		drm_topology_invalidate();
+		return -1;
+	}
+
+	return n;
+}
+
+int drm_topology_index(struct drm_topology *topo, uint32_t id, uint32_t type)
+{
+	uint32_t h = drm_hash_id(id) & topo->ids_mask;
+
+	if (!id)
+		return -1;
+
+	while (topo->ids[h].id) {
+		if (topo->ids[h].id == id)
+			return topo->ids[h].type == type ? topo->ids[h].index : -1;
+
+		h = (h + 1) & topo->ids_mask;
+	}
+
+	return -1;
+}
+
+drmModeConnector * drm_topology_connector(struct drm_topology *topo, uint32_t id)
+{
+	int i = drm_topology_index(topo, id, DRM_MODE_OBJECT_CONNECTOR);
+
+	return i < 0 ? NULL : topo->connectors[i];
+}
+
+drmModeEncoder * drm_topology_encoder(struct drm_topology *topo, uint32_t id)
+{
+	int i = drm_topology_index(topo, id, DRM_MODE_OBJECT_ENCODER);
+
+	return i < 0 ? NULL : topo->encoders[i];
+}
+
+drmModeCrtc * drm_topology_crtc(struct drm_topology *topo, uint32_t id)
+{
+	int i = drm_topology_index(topo, id, DRM_MODE_OBJECT_CRTC);
+
+	return i < 0 ? NULL : topo->crtcs[i];
+}
+
+drmModePlane * drm_topology_plane(struct drm_topology *topo, uint32_t id)
+{
+	int i = drm_topology_index(topo, id, DRM_MODE_OBJECT_PLANE);
+
+	return i < 0 ? NULL : topo->planes[i];
+}
+
+drmModeModeInfo * drm_topology_mode(struct drm_topology *topo, uint32_t connector_id, const char *mode_name)
+{
+	uint32_t h = drm_hash_mode(connector_id, mode_name) & topo->modes_mask;
+
+	if (!connector_id)
+		return NULL;
+
+	while (topo->modes[h].connector_id) {
+		if (topo->modes[h].connector_id == connector_id && !strcmp(topo->modes[h].name, mode_name))
+			return topo->modes[h].mode;
+
+		h = (h + 1) & topo->modes_mask;
+	}
+
+	return NULL;
+}
+
+/* property metadata is shared by every object of a kind: fetch it once per id.
+ * Ids are per device, so the key is the (fd, id) pair; devices may be queried
+ * from several threads, the ioctl itself runs unlocked.
+ */
+
+struct prop_cache_entry {
+	int fd;
+	uint32_t id;			/* 0 marks empty cell */
+	drmModePropertyRes *prop;
+};
+
+static pthread_mutex_t prop_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct prop_cache_entry *prop_cache = NULL;
+static uint32_t prop_cache_mask = 0;
+static uint32_t prop_cache_count = 0;
+static unsigned long prop_cache_lookups = 0;
+
+static uint32_t prop_cache_hash(int fd, uint32_t id)
+{
+	return (id ^ ((uint32_t) fd << 16)) * 2654435761u;
+}
+
+static drmModePropertyRes * prop_cache_find(int fd, uint32_t prop_id)
+{
+	uint32_t i;
+
+	if (!prop_cache)
+		return NULL;
+
+	for (i = prop_cache_hash(fd, prop_id) & prop_cache_mask; prop_cache[i].id; i = (i + 1) & prop_cache_mask) {
+		if (prop_cache[i].id == prop_id && prop_cache[i].fd == fd)
+			return prop_cache[i].prop;
+	}
+
+	return NULL;
+}
+
+static bool prop_cache_grow(void)
+{
+	struct prop_cache_entry *cache;
+	uint32_t size = prop_cache_mask ? (prop_cache_mask + 1) * 2 : 64;
+	uint32_t i, j;
+
+	cache = calloc(size, sizeof(*cache));
+	if (!cache)
+		return false;
+
+	for (i = 0; prop_cache && i <= prop_cache_mask; i++) {
+		if (!prop_cache[i].id)
+			continue;
+
+		for (j = prop_cache_hash(prop_cache[i].fd, prop_cache[i].id) & (size - 1); cache[j].id; j = (j + 1) & (size - 1))
+			;
+
+		cache[j] = prop_cache[i];
+	}
+
+	free(prop_cache);
+	prop_cache = cache;
+	prop_cache_mask = size - 1;
+
+	return true;
+}
+
+/* returned property is owned by the cache */
+
+drmModePropertyRes * drm_prop_get(int fd, uint32_t prop_id)
+{
+	drmModePropertyRes *prop, *cached;
+	uint32_t i;
+
+	pthread_mutex_lock(&prop_cache_lock);
+	prop_cache_lookups++;
+	cached = prop_cache_find(fd, prop_id);
+	pthread_mutex_unlock(&prop_cache_lock);
+
+	if (cached)
+		return cached;
+
+	prop = drmModeGetProperty(fd, prop_id);
+	if (!prop)
+		return NULL;
+
+	pthread_mutex_lock(&prop_cache_lock);
+
+	/* another thread fetched the same property meanwhile */
+	cached = prop_cache_find(fd, prop_id);
+	if (cached) {
+		drmModeFreeProperty(prop);
+		prop = cached;
+		goto unlock;
+	}
+
+	/* keep load below one half; if growing fails keep filling, one cell always stays empty */
+	if ((prop_cache_count + 1) * 2 > prop_cache_mask + 1)
+		prop_cache_grow();
+
+	if (prop_cache_count + 1 > prop_cache_mask) {
+		drmModeFreeProperty(prop);
+		prop = NULL;
+		goto unlock;
+	}
+
+	for (i = prop_cache_hash(fd, prop_id) & prop_cache_mask; prop_cache[i].id; i = (i + 1) & prop_cache_mask)
+		;
+
+	prop_cache[i].fd = fd;
+	prop_cache[i].id = prop_id;
+	prop_cache[i].prop = prop;
+	prop_cache_count++;
+
+unlock:
+	pthread_mutex_unlock(&prop_cache_lock);
+	return prop;
+}
+
+void drm_prop_cache_stats(unsigned long *lookups, unsigned long *fetched)
+{
+	pthread_mutex_lock(&prop_cache_lock);
+	*lookups = prop_cache_lookups;
+	*fetched = prop_cache_count;
+	pthread_mutex_unlock(&prop_cache_lock);
+}
+
+void drm_prop_cache_free(void)
+{
+	uint32_t i;
+
+	for (i = 0; prop_cache && i <= prop_cache_mask; i++) {
+		if (prop_cache[i].id)
+			drmModeFreeProperty(prop_cache[i].prop);
+	}
+
+	free(prop_cache);
+	prop_cache = NULL;
+	prop_cache_mask = 0;
+	prop_cache_count = 0;
+	prop_cache_lookups = 0;
+}
+
+/* atomic modesetting helpers: properties are looked up by name */
+
+/* several properties of one object with a single GetProperties: ids of missing ones are 0 */
+
+int drm_get_prop_ids(int fd, uint32_t obj_id, uint32_t obj_type, const char * const *names, uint32_t *ids, int count)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	int found = 0;
+	uint32_t i;
+	int j;
+
+	memset(ids, 0, count * sizeof(*ids));
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props)
+		return 0;
+
+	for (i = 0; i < props->count_props && found < count; i++) {
+		prop = drm_prop_get(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		for (j = 0; j < count; j++) {
+			if (!ids[j] && !strcmp(prop->name, names[j])) {
+				ids[j] = prop->prop_id;
+				found++;
+			}
+		}
+	}
+
+	drmModeFreeObjectProperties(props);
+	return found;
+}
+
+uint32_t drm_get_prop_id(int fd, uint32_t obj_id, uint32_t obj_type, const char *name)
+{
+	uint32_t id;
+
+	drm_get_prop_ids(fd, obj_id, obj_type, &name, &id, 1);
+	return id;
+}
+
+int drm_get_prop_value(int fd, uint32_t obj_id, uint32_t obj_type, const char *name, uint64_t *value)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	int ret = -1;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props)
+		return -1;
+
+	for (i = 0; i < props->count_props && ret; i++) {
+		prop = drm_prop_get(fd, props->props[i]);
+		if (prop && !strcmp(prop->name, name)) {
+			*value = props->prop_values[i];
+			ret = 0;
+		}
+	}
+
+	drmModeFreeObjectProperties(props);
+	return ret;
+}
+
+int drm_atomic_add(drmModeAtomicReq *req, int fd, uint32_t obj_id, uint32_t obj_type, const char *name, uint64_t value)
+{
+	uint32_t prop_id;
+
+	prop_id = drm_get_prop_id(fd, obj_id, obj_type, name);
+	if (!prop_id) {
+		fprintf(stderr, "object %u has no property %s\n", obj_id, name);
+		return -1;
+	}
+
+	return drmModeAtomicAddProperty(req, obj_id, prop_id, value) < 0 ? -1 : 0;
+}
+
+/* primary plane of the crtc: needs DRM_CLIENT_CAP_UNIVERSAL_PLANES */
+
+uint32_t drm_get_primary_plane(int fd, uint32_t crtc_id)
+{
+	drmModePlaneRes *res;
+	drmModePlane *plane;
+	uint64_t type;
+	uint32_t id = 0;
+	uint32_t i;
+	int pipe;
+
+	pipe = drm_get_crtc_index(fd, crtc_id);
+	if (pipe < 0)
+		return 0;
+
+	/* topology cache may predate universal planes cap, ask kernel directly */
+
+	res = drmModeGetPlaneResources(fd);
+	if (!res)
+		return 0;
+
+	for (i = 0; i < res->count_planes && !id; i++) {
+		plane = drmModeGetPlane(fd, res->planes[i]);
+		if (!plane)
+			continue;
+
+		if ((plane->possible_crtcs & (1 << pipe)) &&
+				!drm_get_prop_value(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) &&
+				type == DRM_PLANE_TYPE_PRIMARY)
+			id = plane->plane_id;
+
+		drmModeFreePlane(plane);
+	}
+
+	drmModeFreePlaneResources(res);
+	return id;
+}
+
+/*
+ * Variable refresh rate: the connector reports a panel with a refresh range
+ * in vrr_capable, the crtc then stretches vblank until the next flip arrives
+ * once VRR_ENABLED is set. The property exists only for atomic clients.
+ */
+
+bool drm_vrr_capable(int fd, uint32_t connector_id)
+{
+	uint64_t capable = 0;
+
+	if (drm_get_prop_value(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable", &capable))
+		return false;
+
+	return capable != 0;
+}
+
+int drm_vrr_enable(int fd, uint32_t crtc_id, bool enable)
+{
+	drmModeAtomicReq *req;
+	int ret;
+
+	if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+		fprintf(stderr, "no support for atomic modesetting\n");
+		return -1;
+	}
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	ret = drm_atomic_add(req, fd, crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", enable);
+
+	/* some drivers reprogram timings, let them do a modeset */
+	if (!ret)
+		ret = drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+/*
+ * Color management in the display engine: DEGAMMA_LUT -> CTM -> GAMMA_LUT
+ * are applied to every pixel at scanout, so brightness, gamma and color
+ * correction cost nothing per frame. Drivers without the atomic color
+ * properties get the legacy gamma ramp only.
+ */
+
+int drm_color_lut_size(int fd, uint32_t crtc_id, bool degamma)
+{
+	uint64_t size = 0;
+	drmModeCrtc *crtc;
+
+	if (!drm_get_prop_value(fd, crtc_id, DRM_MODE_OBJECT_CRTC,
+			degamma ? "DEGAMMA_LUT_SIZE" : "GAMMA_LUT_SIZE", &size))
+		return (int) size;
+
+	if (degamma)
+		return 0;
+
+	crtc = drmModeGetCrtc(fd, crtc_id);
+	if (!crtc)
+		return 0;
+
+	size = crtc->gamma_size;
+	drmModeFreeCrtc(crtc);
+
+	return (int) size;
+}
+
+/* out = brightness * in^exponent, same curve on all channels */
+
+void drm_color_lut_fill(struct drm_color_lut *lut, int size, double exponent, double brightness)
+{
+	double v;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		v = brightness * pow((double) i / (size > 1 ? size - 1 : 1), exponent);
+
+		if (v < 0.0)
+			v = 0.0;
+		if (v > 1.0)
+			v = 1.0;
+
+		lut[i].red = lut[i].green = lut[i].blue = (uint16_t) (v * 0xffff + 0.5);
+		lut[i].reserved = 0;
+	}
+}
+
+/* CTM entries are S31.32 sign-magnitude fixed point */
+
+static uint64_t drm_color_fixed(double v)
+{
+	uint64_t sign = 0;
+
+	if (v < 0.0) {
+		sign = 1ULL << 63;
+		v = -v;
+	}
+
+	return sign | (uint64_t) (v * 4294967296.0);
+}
+
+static int drm_color_blob(int fd, uint32_t crtc_id, const char *name, const void *data, size_t size,
+		drmModeAtomicReq *req, uint32_t *blob)
+{
+	*blob = 0;
+
+	if (!drm_get_prop_id(fd, crtc_id, DRM_MODE_OBJECT_CRTC, name)) {
+		if (data)
+			fprintf(stderr, "crtc %u has no %s, ignored\n", crtc_id, name);
+		return 0;
+	}
+
+	if (data && drmModeCreatePropertyBlob(fd, data, size, blob)) {
+		perror("failed drmModeCreatePropertyBlob");
+		return -1;
+	}
+
+	return drm_atomic_add(req, fd, crtc_id, DRM_MODE_OBJECT_CRTC, name, *blob);
+}
+
+static int drm_color_set_legacy(int fd, uint32_t crtc_id, struct drm_color_lut *gamma, int gamma_size)
+{
+	uint16_t *red, *green, *blue;
+	drmModeCrtc *crtc;
+	int size, i, j;
+	int ret;
+
+	crtc = drmModeGetCrtc(fd, crtc_id);
+	if (!crtc)
+		return -1;
+
+	size = crtc->gamma_size;
+	drmModeFreeCrtc(crtc);
+
+	if (size < 2) {
+		fprintf(stderr, "crtc %u has no gamma ramp\n", crtc_id);
+		return -1;
+	}
+
+	red = calloc(3 * size, sizeof(*red));
+	if (!red)
+		return -1;
+
+	green = red + size;
+	blue = green + size;
+
+	/* resample to the ramp size, identity without a LUT */
+
+	for (i = 0; i < size; i++) {
+		if (gamma && gamma_size > 0) {
+			j = (int) ((long) i * (gamma_size - 1) / (size - 1));
+			red[i] = gamma[j].red;
+			green[i] = gamma[j].green;
+			blue[i] = gamma[j].blue;
+		} else {
+			red[i] = green[i] = blue[i] = (uint16_t) ((long) i * 0xffff / (size - 1));
+		}
+	}
+
+	ret = drmModeCrtcSetGamma(fd, crtc_id, size, red, green, blue);
+	if (ret)
+		perror("failed drmModeCrtcSetGamma");
+
+	free(red);
+	return ret;
+}
+
+static bool drm_color_atomic(int fd, uint32_t crtc_id)
+{
+	return drm_get_prop_id(fd, crtc_id, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT") &&
+		!drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
+}
+
+static int drm_color_commit(int fd, uint32_t crtc_id, struct drm_color_lut *degamma, int degamma_size,
+		struct drm_color_ctm *ctm, struct drm_color_lut *gamma, int gamma_size)
+{
+	drmModeAtomicReq *req;
+	uint32_t blobs[3];
+	int ret, i;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	ret = drm_color_blob(fd, crtc_id, "DEGAMMA_LUT", degamma, degamma_size * sizeof(*degamma), req, &blobs[0]);
+	ret |= drm_color_blob(fd, crtc_id, "CTM", ctm, sizeof(*ctm), req, &blobs[1]);
+	ret |= drm_color_blob(fd, crtc_id, "GAMMA_LUT", gamma, gamma_size * sizeof(*gamma), req, &blobs[2]);
+
+	if (!ret) {
+		ret = drmModeAtomicCommit(fd, req, 0, NULL);
+		if (ret)
+			perror("failed drmModeAtomicCommit(color)");
+	}
+
+	/* crtc state holds its own references */
+
+	for (i = 0; i < 3; i++) {
+		if (blobs[i])
+			drmModeDestroyPropertyBlob(fd, blobs[i]);
+	}
+
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+/*
+ * Program crtc color pipeline in one atomic commit. NULL stages are set to
+ * bypass, so drm_color_set(fd, crtc_id, NULL, 0, NULL, NULL, 0) resets it.
+ * ctm is a row major 3x3 matrix applied to linear RGB.
+ */
+
+int drm_color_set(int fd, uint32_t crtc_id, struct drm_color_lut *degamma, int degamma_size,
+		const double *ctm, struct drm_color_lut *gamma, int gamma_size)
+{
+	struct drm_color_ctm matrix;
+	int i;
+
+	if (!drm_color_atomic(fd, crtc_id)) {
+		if (degamma || ctm)
+			fprintf(stderr, "crtc %u: no color pipeline, only gamma is applied\n", crtc_id);
+
+		return drm_color_set_legacy(fd, crtc_id, gamma, gamma_size);
+	}
+
+	if (ctm) {
+		for (i = 0; i < 9; i++)
+			matrix.matrix[i] = drm_color_fixed(ctm[i]);
+	}
+
+	return drm_color_commit(fd, crtc_id, degamma, degamma_size, ctm ? &matrix : NULL, gamma, gamma_size);
+}
+
+/* copy of a color blob property, NULL for bypass or a missing property */
+
+static int drm_color_blob_copy(int fd, uint32_t crtc_id, const char *name, void **data, size_t *size)
+{
+	drmModePropertyBlobRes *blob;
+	uint64_t id = 0;
+
+	*data = NULL;
+	*size = 0;
+
+	if (!drm_get_prop_id(fd, crtc_id, DRM_MODE_OBJECT_CRTC, name))
+		return 0;
+
+	if (drm_get_prop_value(fd, crtc_id, DRM_MODE_OBJECT_CRTC, name, &id))
+		return -1;
+
+	if (!id)
+		return 0;
+
+	blob = drmModeGetPropertyBlob(fd, id);
+	if (!blob) {
+		perror("failed drmModeGetPropertyBlob");
+		return -1;
+	}
+
+	*data = malloc(blob->length);
+	if (*data) {
+		memcpy(*data, blob->data, blob->length);
+		*size = blob->length;
+	}
+
+	drmModeFreePropertyBlob(blob);
+	return *data ? 0 : -1;
+}
+
+static int drm_color_save_legacy(int fd, uint32_t crtc_id, struct drm_color_state *state)
+{
+	uint16_t *red, *green, *blue;
+	drmModeCrtc *crtc;
+	int size, i;
+
+	crtc = drmModeGetCrtc(fd, crtc_id);
+	if (!crtc)
+		return -1;
+
+	size = crtc->gamma_size;
+	drmModeFreeCrtc(crtc);
+
+	if (size < 2)
+		return -1;
+
+	red = calloc(3 * size, sizeof(*red));
+	state->gamma = calloc(size, sizeof(*state->gamma));
+	if (!red || !state->gamma)
+		goto err;
+
+	green = red + size;
+	blue = green + size;
+
+	if (drmModeCrtcGetGamma(fd, crtc_id, size, red, green, blue)) {
+		perror("failed drmModeCrtcGetGamma");
+		goto err;
+	}
+
+	for (i = 0; i < size; i++) {
+		state->gamma[i].red = red[i];
+		state->gamma[i].green = green[i];
+		state->gamma[i].blue = blue[i];
+	}
+
+	state->gamma_size = size;
+	state->legacy = true;
+
+	free(red);
+	return 0;
+
+err:
+	free(red);
+	free(state->gamma);
+	state->gamma = NULL;
+	return -1;
+}
+
+/* current color pipeline of the crtc, to be put back by drm_color_restore() */
+
+int drm_color_save(int fd, uint32_t crtc_id, struct drm_color_state *state)
+{
+	size_t size;
+	void *data;
+
+	memset(state, 0, sizeof(*state));
+
+	if (!drm_color_atomic(fd, crtc_id))
+		return drm_color_save_legacy(fd, crtc_id, state);
+
+	if (drm_color_blob_copy(fd, crtc_id, "DEGAMMA_LUT", &data, &size))
+		goto err;
+
+	state->degamma = data;
+	state->degamma_size = size / sizeof(*state->degamma);
+
+	if (drm_color_blob_copy(fd, crtc_id, "CTM", &data, &size))
+		goto err;
+
+	state->ctm = data;
+
+	if (state->ctm && size != sizeof(*state->ctm)) {
+		fprintf(stderr, "crtc %u: bad CTM blob size %zu\n", crtc_id, size);
+		goto err;
+	}
+
+	if (drm_color_blob_copy(fd, crtc_id, "GAMMA_LUT", &data, &size))
+		goto err;
+
+	state->gamma = data;
+	state->gamma_size = size / sizeof(*state->gamma);
+
+	return 0;
+
+err:
+	drm_color_free(state);
+	return -1;
+}
+
+int drm_color_restore(int fd, uint32_t crtc_id, struct drm_color_state *state)
+{
+	if (state->legacy)
+		return drm_color_set_legacy(fd, crtc_id, state->gamma, state->gamma_size);
+
+	return drm_color_commit(fd, crtc_id, state->degamma, state->degamma_size,
+			state->ctm, state->gamma, state->gamma_size);
+}
+
+void drm_color_free(struct drm_color_state *state)
+{
+	free(state->degamma);
+	free(state->ctm);
+	free(state->gamma);
+	memset(state, 0, sizeof(*state));
+}
+
+/*
+ * Hardware cursor: image is uploaded once into a dumb buffer of the cursor
+ * plane size, after that moving is a position-only update. Moves are only
+ * recorded, drm_cursor_flush() applies the latest one, so callers flushing
+ * once per vblank issue at most one ioctl per frame however often it moves.
+ * Legacy cursor ioctls end up on the CURSOR plane on atomic drivers.
+ */
+
+int drm_cursor_init(int fd, uint32_t crtc_id, struct drm_cursor *cursor)
+{
+	struct drm_mode_destroy_dumb dreq;
+	struct drm_mode_create_dumb creq;
+	struct drm_mode_map_dumb mreq;
+	uint64_t cap;
+
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->fd = fd;
+	cursor->crtc_id = crtc_id;
+
+	/* not all drivers report cursor size, 64x64 is the traditional one */
+
+	cursor->width = drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &cap) ? 64 : cap;
+	cursor->height = drmGetCap(fd, DRM_CAP_CURSOR_HEIGHT, &cap) ? 64 : cap;
+
+	memset(&creq, 0, sizeof(creq));
+	creq.width = cursor->width;
+	creq.height = cursor->height;
+	creq.bpp = 32;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq)) {
+		perror("failed drmIoctl(DRM_IOCTL_MODE_CREATE_DUMB)");
+		return -1;
+	}
+
+	cursor->handle = creq.handle;
+	cursor->stride = creq.pitch;
+	cursor->size = creq.size;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = cursor->handle;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq)) {
+		perror("failed drmIoctl(DRM_IOCTL_MODE_MAP_DUMB)");
+		goto err_destroy;
+	}
+
+	cursor->map = mmap(0, cursor->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
+	if (cursor->map == MAP_FAILED) {
+		perror("failed mmap()");
+		goto err_destroy;
+	}
+
+	memset(cursor->map, 0, cursor->size);
+	return 0;
+
+err_destroy:
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = cursor->handle;
+	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+
+	cursor->handle = 0;
+	cursor->map = NULL;
+	return -1;
+}
+
+void drm_cursor_fini(struct drm_cursor *cursor)
+{
+	struct drm_mode_destroy_dumb dreq;
+
+	if (!cursor->handle)
+		return;
+
+	drm_cursor_show(cursor, false);
+	munmap(cursor->map, cursor->size);
+
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = cursor->handle;
+
+	if (drmIoctl(cursor->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq))
+		fprintf(stderr, "cannot destroy cursor buffer\n");
+
+	cursor->handle = 0;
+}
+
+/* ARGB8888 image, clipped to the cursor plane size */
+
+int drm_cursor_set_image(struct drm_cursor *cursor, const uint32_t *argb, uint32_t width, uint32_t height,
+		int hot_x, int hot_y)
+{
+	uint32_t w = width < cursor->width ? width : cursor->width;
+	uint32_t h = height < cursor->height ? height : cursor->height;
+	uint32_t i;
+
+	memset(cursor->map, 0, cursor->size);
+
+	for (i = 0; i < h; i++)
+		memcpy((char *) cursor->map + i * cursor->stride, argb + i * width, w * 4);
+
+	cursor->hot_x = hot_x;
+	cursor->hot_y = hot_y;
+
+	/* new hotspot moves the image */
+	cursor->moved = true;
+
+	if (!cursor->visible)
+		return 0;
+
+	return drmModeSetCursor2(cursor->fd, cursor->crtc_id, cursor->handle,
+			cursor->width, cursor->height, hot_x, hot_y);
+}
+
+int drm_cursor_show(struct drm_cursor *cursor, bool visible)
+{
+	int ret;
+
+	if (cursor->visible == visible)
+		return 0;
+
+	if (visible)
+		ret = drmModeSetCursor2(cursor->fd, cursor->crtc_id, cursor->handle,
+				cursor->width, cursor->height, cursor->hot_x, cursor->hot_y);
+	else
+		ret = drmModeSetCursor(cursor->fd, cursor->crtc_id, 0, 0, 0);
+
+	if (ret) {
+		perror("failed drmModeSetCursor");
+		return ret;
+	}
+
+	cursor->visible = visible;
+	return 0;
+}
+
+/* returns true if a move still waiting for flush was superseded */
+
+bool drm_cursor_move(struct drm_cursor *cursor, int x, int y)
+{
+	bool superseded = cursor->moved;
+
+	cursor->x = x;
+	cursor->y = y;
+	cursor->moved = true;
+
+	return superseded;
+}
+
+int drm_cursor_flush(struct drm_cursor *cursor)
+{
+	int ret;
+
+	if (!cursor->moved || !cursor->visible)
+		return 0;
+
+	cursor->moved = false;
+
+	/* hotspot lands on the requested position */
+	ret = drmModeMoveCursor(cursor->fd, cursor->crtc_id, cursor->x - cursor->hot_x, cursor->y - cursor->hot_y);
+	if (ret)
+		perror("failed drmModeMoveCursor");
+
+	return ret;
+}
+
+/* hotplug notifications: kernel uevents, no libudev required */
+
+int drm_uevent_open(void)
+{
+	struct sockaddr_nl addr;
+	int sock;
+
+	sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if (sock < 0) {
+		perror("failed socket(NETLINK_KOBJECT_UEVENT)");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;		/* kernel uevents, not udev rebroadcasts */
+
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("failed bind(NETLINK_KOBJECT_UEVENT)");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* read one uevent: "action@devpath\0KEY=VALUE\0KEY=VALUE\0..."
+ * only hotplugs of the device open on fd count, fd < 0 takes any of them
+ */
+
+bool drm_uevent_hotplug(int sock, int fd, uint32_t *connector_id)
+{
+	struct sockaddr_nl addr;
+	socklen_t addrlen = sizeof(addr);
+	bool drm = false, hotplug = false;
+	long dev_major = -1, dev_minor = -1;
+	struct stat st;
+	char buf[4096];
+	ssize_t len;
+	char *p;
+
+	len = recvfrom(sock, buf, sizeof(buf) - 1, 0, (struct sockaddr *) &addr, &addrlen);
+	if (len <= 0)
+		return false;
+
+	/* only trust messages sent by the kernel */
+	if (addr.nl_pid != 0)
+		return false;
+
+	buf[len] = '\0';
+
+	if (connector_id)
+		*connector_id = 0;
+
+	for (p = buf; p < buf + len; p += strlen(p) + 1) {
+		if (!strcmp(p, "SUBSYSTEM=drm"))
+			drm = true;
+		else if (!strcmp(p, "HOTPLUG=1"))
+			hotplug = true;
+		else if (!strncmp(p, "MAJOR=", 6))
+			dev_major = strtol(p + 6, NULL, 10);
+		else if (!strncmp(p, "MINOR=", 6))
+			dev_minor = strtol(p + 6, NULL, 10);
+		else if (!strncmp(p, "CONNECTOR=", 10) && connector_id)
+			*connector_id = strtoul(p + 10, NULL, 10);	/* hint: only this one changed */
+	}
+
+	if (!drm || !hotplug)
+		return false;
+
+	/* another card: a uevent without a device number can't be told apart, take it */
+	if (fd >= 0 && dev_major >= 0 && dev_minor >= 0 && !fstat(fd, &st) && S_ISCHR(st.st_mode) &&
+			(major(st.st_rdev) != dev_major || minor(st.st_rdev) != dev_minor))
+		return false;
+
+	return true;
+}
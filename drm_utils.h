@@ -1,8 +1,11 @@
 
+#include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/mman.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,9 +13,13 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <math.h>
+#include <time.h>
 #include <error.h>
 #include <errno.h>
 
+#include <linux/netlink.h>
+
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
@@ -29,10 +36,162 @@ struct kms_display {
 	drmModeCrtc *crtc;
 };
 
+/* resident copy of KMS topology: objects are fetched once and indexed by id
+ * and by (connector, mode name); everything returned by drm_topology_*
+ * lookups is owned by the cache and stays valid until it is invalidated
+ */
+
+struct drm_topology_id {
+	uint32_t id;			/* 0 marks empty cell */
+	uint32_t type;			/* DRM_MODE_OBJECT_* */
+	int index;
+};
+
+struct drm_topology_mode {
+	uint32_t connector_id;	/* 0 marks empty cell */
+	const char *name;
+	drmModeModeInfo *mode;
+};
+
+struct drm_topology {
+	int fd;
+
+	drmModeRes *resources;
+	drmModePlaneRes *plane_resources;
+
+	drmModeConnector **connectors;
+	drmModeEncoder **encoders;
+	drmModeCrtc **crtcs;
+	drmModePlane **planes;
+	int count_planes;
+
+	struct drm_topology_id *ids;
+	uint32_t ids_mask;
+	struct drm_topology_mode *modes;
+	uint32_t modes_mask;
+};
+
 /* */
 
+/* not in older libdrm headers */
+
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP	0x15
+#endif
+
+/* hardware cursor on a crtc */
+
+struct drm_cursor {
+	int fd;
+	uint32_t crtc_id;
+
+	uint32_t handle;		/* dumb buffer of cursor plane size */
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint64_t size;
+	void *map;
+
+	int hot_x;
+	int hot_y;
+	int x;					/* hotspot position */
+	int y;
+	bool visible;
+	bool moved;				/* position not flushed yet */
+};
+
+/* saved crtc color pipeline, NULL stages are in bypass */
+
+struct drm_color_state {
+	bool legacy;			/* gamma ramp only, no color properties */
+	struct drm_color_lut *degamma;
+	int degamma_size;
+	struct drm_color_ctm *ctm;
+	struct drm_color_lut *gamma;
+	int gamma_size;
+};
+
+/* frame timing statistics */
+
+struct drm_time_stats {
+	unsigned long count;
+	double sum;
+	double min;
+	double max;
+};
+
+/* frame loop accounting of the GL examples */
+
+struct drm_frame_stats {
+	int frames;
+	int overlapped;			/* frames started while GPU still rendered the previous one */
+	long inflight;			/* sum of frames in flight at each submit */
+	double cpu_busy;		/* seconds spent preparing frames */
+	double blocked;			/* seconds waiting for a free buffer */
+	struct drm_time_stats render;	/* ms from start of rendering to submit or glFinish */
+};
+
+/* connector query: full probe (default) or current state without probing */
+
+void drm_set_probe(bool probe);
+drmModeConnector * drm_get_connector(int fd, uint32_t connector_id);
+void drm_report_first_modeset(void);
+
+bool drm_get_conf(int fd, struct kms_display *kms, uint32_t nid, uint32_t eid, uint32_t cid, char *mode_name);
 bool drm_get_conf_cmdline(int fd, struct kms_display *kms, int argc, char *argv[]);
 bool drm_autoconf(int fd, struct kms_display *kms);
+int drm_autoconf_all(int fd, struct kms_display *kms, int max);
 void dump_drm_configuration(struct kms_display *kms);
 void dump_crtc_configuration(char *msg, drmModeCrtc *crtc);
 drmModeModeInfo * drm_get_mode_by_name(int fd, uint32_t connector_id, char *mode_name);
+int drm_get_crtc_index(int fd, uint32_t crtc_id);
+int drm_queue_vblank_event(int fd, uint32_t crtc_id, void *data);
+bool drm_async_flip_supported(int fd, bool atomic);
+
+void drm_time_stats_add(struct drm_time_stats *stats, double ms);
+void drm_time_stats_dump(struct drm_time_stats *stats, const char *label);
+double drm_event_ms(struct timespec *from, unsigned int sec, unsigned int usec);
+double drm_elapsed(struct timespec *from);
+void drm_frame_stats_dump(struct drm_frame_stats *stats, double seconds, int depth, bool fenced, const char *api);
+
+struct drm_topology * drm_topology_get(int fd);
+void drm_topology_invalidate(void);
+int drm_topology_refresh(struct drm_topology *topo, uint32_t connector_id, uint32_t *changed, int max);
+drmModeConnector * drm_topology_connector(struct drm_topology *topo, uint32_t id);
+drmModeEncoder * drm_topology_encoder(struct drm_topology *topo, uint32_t id);
+drmModeCrtc * drm_topology_crtc(struct drm_topology *topo, uint32_t id);
+drmModePlane * drm_topology_plane(struct drm_topology *topo, uint32_t id);
+int drm_topology_index(struct drm_topology *topo, uint32_t id, uint32_t type);
+drmModeModeInfo * drm_topology_mode(struct drm_topology *topo, uint32_t connector_id, const char *mode_name);
+
+/* cached per (fd, id) until drm_prop_cache_free(): don't reuse an fd number in between */
+drmModePropertyRes * drm_prop_get(int fd, uint32_t prop_id);
+void drm_prop_cache_stats(unsigned long *lookups, unsigned long *fetched);
+void drm_prop_cache_free(void);
+
+uint32_t drm_get_prop_id(int fd, uint32_t obj_id, uint32_t obj_type, const char *name);
+int drm_get_prop_ids(int fd, uint32_t obj_id, uint32_t obj_type, const char * const *names, uint32_t *ids, int count);
+int drm_get_prop_value(int fd, uint32_t obj_id, uint32_t obj_type, const char *name, uint64_t *value);
+int drm_atomic_add(drmModeAtomicReq *req, int fd, uint32_t obj_id, uint32_t obj_type, const char *name, uint64_t value);
+uint32_t drm_get_primary_plane(int fd, uint32_t crtc_id);
+bool drm_vrr_capable(int fd, uint32_t connector_id);
+int drm_vrr_enable(int fd, uint32_t crtc_id, bool enable);
+
+int drm_color_lut_size(int fd, uint32_t crtc_id, bool degamma);
+void drm_color_lut_fill(struct drm_color_lut *lut, int size, double exponent, double brightness);
+int drm_color_set(int fd, uint32_t crtc_id, struct drm_color_lut *degamma, int degamma_size,
+		const double *ctm, struct drm_color_lut *gamma, int gamma_size);
+int drm_color_save(int fd, uint32_t crtc_id, struct drm_color_state *state);
+int drm_color_restore(int fd, uint32_t crtc_id, struct drm_color_state *state);
+void drm_color_free(struct drm_color_state *state);
+
+int drm_cursor_init(int fd, uint32_t crtc_id, struct drm_cursor *cursor);
+void drm_cursor_fini(struct drm_cursor *cursor);
+int drm_cursor_set_image(struct drm_cursor *cursor, const uint32_t *argb, uint32_t width, uint32_t height,
+		int hot_x, int hot_y);
+int drm_cursor_show(struct drm_cursor *cursor, bool visible);
+bool drm_cursor_move(struct drm_cursor *cursor, int x, int y);
+int drm_cursor_flush(struct drm_cursor *cursor);
+
+int drm_uevent_open(void);
+bool drm_uevent_hotplug(int sock, int fd, uint32_t *connector_id);
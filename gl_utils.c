@@ -2,51 +2,768 @@
 
 /* */
 
-void render_stuff(int width, int height, GLfloat rotz)
+#ifdef HAVE_GLES
+static bool gl_use_gles = true;
+#else
+static bool gl_use_gles = false;
+#endif
+
+bool gl_set_api(const char *name)
+{
+    if (!strcmp(name, "gles")) {
+        gl_use_gles = true;
+    } else if (!strcmp(name, "gl")) {
+        gl_use_gles = false;
+    } else {
+        fprintf(stderr, "unknown client API '%s', use gl or gles\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+bool gl_api_gles(void)
+{
+    return gl_use_gles;
+}
+
+const char * gl_api_name(void)
+{
+    return gl_use_gles ? "GLES" : "GL";
+}
+
+EGLint gl_renderable_type(void)
+{
+    return gl_use_gles ? EGL_OPENGL_ES2_BIT : EGL_OPENGL_BIT;
+}
+
+/* binds the API too; GLES 3 where the driver has it, the renderer only needs 2 */
+
+EGLContext gl_context_create(EGLDisplay dpy, EGLConfig config)
+{
+    static const EGLint gles3_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    static const EGLint gles2_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    EGLContext ctx;
+
+    if (!gl_use_gles) {
+        eglBindAPI(EGL_OPENGL_API);
+        return eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL);
+    }
+
+    eglBindAPI(EGL_OPENGL_ES_API);
+
+    ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, gles3_attribs);
+    if (ctx == EGL_NO_CONTEXT)
+        ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, gles2_attribs);
+
+    return ctx;
+}
+
+/* shader renderer: geometry lives in a VBO uploaded once, the whole transform
+ * is one matrix built on the CPU; per frame it is viewport, uniform, clear, draw
+ */
+
+static const char vertex_shader_src[] =
+    "attribute vec2 position;\n"
+    "attribute vec3 color;\n"
+    "uniform mat4 mvp;\n"
+    "varying vec3 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    v_color = color;\n"
+    "    gl_Position = mvp * vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+static const char fragment_shader_src[] =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "varying vec3 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = vec4(v_color, 1.0);\n"
+    "}\n";
+
+enum {
+    ATTRIB_POSITION,
+    ATTRIB_COLOR,
+};
+
+static struct {
+    GLuint program;
+    GLuint vbo;
+    GLint mvp;
+    int width, height;
+} renderer;
+
+static GLuint compile_shader(GLenum type, const char *src)
 {
-    GLfloat view_rotx = 0.0, view_roty = 0.0, view_rotz = rotz;
-    static const GLfloat verts[3][2] = {
-        { -1, -1 },
-        {  1, -1 },
-        {  0,  1 }
+    GLuint shader;
+    GLint ok;
+    char log[512];
+
+    shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "failed to compile %s shader: %s\n",
+            type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+GLuint gl_program_create(const char *vs_src, const char *fs_src, const char * const *attribs, int count)
+{
+    GLuint vs, fs, program;
+    GLint ok;
+    char log[512];
+    int i;
+
+    vs = compile_shader(GL_VERTEX_SHADER, vs_src);
+    if (!vs)
+        return 0;
+
+    fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
+    if (!fs) {
+        glDeleteShader(vs);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+
+    for (i = 0; i < count; i++)
+        glBindAttribLocation(program, i, attribs[i]);
+
+    glLinkProgram(program);
+
+    /* program keeps them alive */
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        fprintf(stderr, "failed to link program: %s\n", log);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+/* column major 4x4: out = a * b */
+
+void gl_mat4_multiply(GLfloat *out, const GLfloat *a, const GLfloat *b)
+{
+    GLfloat r[16];
+    int i, j, k;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            r[i * 4 + j] = 0.0f;
+            for (k = 0; k < 4; k++)
+                r[i * 4 + j] += a[k * 4 + j] * b[i * 4 + k];
+        }
+    }
+
+    memcpy(out, r, sizeof(r));
+}
+
+/* what glFrustum, glTranslatef and glRotatef(rotz, 0, 0, 1) used to build */
+
+void gl_mat4_mvp(GLfloat *mvp, int width, int height, GLfloat rotz)
+{
+    GLfloat ar = (GLfloat) width / (GLfloat) height;
+    GLfloat n = 5.0f, f = 60.0f;
+    GLfloat a = rotz * (GLfloat) M_PI / 180.0f;
+
+    GLfloat proj[16] = {
+        n / ar, 0, 0, 0,
+        0, n, 0, 0,
+        0, 0, -(f + n) / (f - n), -1,
+        0, 0, -2 * f * n / (f - n), 0,
     };
-    static const GLfloat colors[3][3] = {
-        { 1, 0, 0 },
-        { 0, 1, 0 },
-        { 0, 0, 1 }
+
+    GLfloat model[16] = {
+        cosf(a), sinf(a), 0, 0,
+        -sinf(a), cosf(a), 0, 0,
+        0, 0, 1, 0,
+        0, 0, -10.0f, 1,
     };
-    GLfloat ar = (GLfloat) width / (GLfloat) height;
 
-    glViewport(0, 0, (GLint) width, (GLint) height);
+    gl_mat4_multiply(mvp, proj, model);
+}
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glFrustum(-ar, ar, -1, 1, 5.0, 60.0);
+bool render_init(void)
+{
+    static const char * const attribs[] = { "position", "color" };
+    static const GLfloat verts[] = {
+        /* x, y, r, g, b */
+        -1, -1, 1, 0, 0,
+         1, -1, 0, 1, 0,
+         0,  1, 0, 0, 1,
+    };
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glTranslatef(0.0, 0.0, -10.0);
+    printf("%s renderer: %s, %s\n", gl_api_name(), glGetString(GL_RENDERER), glGetString(GL_VERSION));
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderer.program = gl_program_create(vertex_shader_src, fragment_shader_src, attribs, 2);
+    if (!renderer.program)
+        return false;
 
-    glPushMatrix();
-    glRotatef(view_rotx, 1, 0, 0);
-    glRotatef(view_roty, 0, 1, 0);
-    glRotatef(view_rotz, 0, 0, 1);
+    renderer.mvp = glGetUniformLocation(renderer.program, "mvp");
 
-    glVertexPointer(2, GL_FLOAT, 0, verts);
-    glColorPointer(3, GL_FLOAT, 0, colors);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_COLOR_ARRAY);
+    glGenBuffers(1, &renderer.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
 
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glVertexAttribPointer(ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void *) 0);
+    glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void *) (2 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glEnableVertexAttribArray(ATTRIB_COLOR);
+
+    glUseProgram(renderer.program);
 
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_COLOR_ARRAY);
+    renderer.width = renderer.height = 0;
+
+    return true;
+}
+
+void render_fini(void)
+{
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    glDisableVertexAttribArray(ATTRIB_COLOR);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+
+    glDeleteBuffers(1, &renderer.vbo);
+    glDeleteProgram(renderer.program);
+
+    memset(&renderer, 0, sizeof(renderer));
+}
 
-    glPopMatrix();
+/* queue frame rendering: GPU may still be busy when this returns */
 
+void render_frame(int width, int height, GLfloat rotz)
+{
+    GLfloat mvp[16];
+
+    if (width != renderer.width || height != renderer.height) {
+        glViewport(0, 0, (GLint) width, (GLint) height);
+        renderer.width = width;
+        renderer.height = height;
+    }
+
+    gl_mat4_mvp(mvp, width, height, rotz);
+    glUniformMatrix4fv(renderer.mvp, 1, GL_FALSE, mvp);
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+/* render frame and wait for GPU: buffer is ready to scan out on return */
+
+void render_stuff(int width, int height, GLfloat rotz)
+{
+    render_frame(width, height, rotz);
     glFinish();
 }
 
+/* stress scene: a grid of quads covering the screen, repeated in blended
+ * layers so every layer is a full read-modify-write pass. With GLES 3 or
+ * GL 3.3 one quad is drawn instanced, one instance per object and layer;
+ * GLES 2 has no instancing, there all quads are baked into one static VBO.
+ * Both are a single draw call.
+ */
+
+static const char stress_vertex_src[] =
+    "attribute vec2 position;\n"
+    "attribute vec2 texcoord;\n"
+    "attribute vec4 color;\n"
+    "varying vec2 v_texcoord;\n"
+    "varying vec4 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    v_texcoord = texcoord;\n"
+    "    v_color = color;\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+/* corner of the unit quad per vertex, rect and color per instance */
+
+static const char stress_instanced_vertex_src[] =
+    "attribute vec2 corner;\n"
+    "attribute vec4 rect;\n"
+    "attribute vec4 color;\n"
+    "varying vec2 v_texcoord;\n"
+    "varying vec4 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 p = rect.xy + corner * rect.zw;\n"
+    "    v_texcoord = (p + 1.0) * 0.5;\n"
+    "    v_color = color;\n"
+    "    gl_Position = vec4(p, 0.0, 1.0);\n"
+    "}\n";
+
+/* STRESS_ALU and STRESS_TEXTURE are prepended: GLSL ES 1.00 wants constant loop bounds */
+
+static const char stress_fragment_src[] =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D tex;\n"
+    "uniform float phase;\n"
+    "varying vec2 v_texcoord;\n"
+    "varying vec4 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 c = v_color;\n"
+    "    float x = v_texcoord.x + phase;\n"
+    "    for (int i = 0; i < STRESS_ALU; i++)\n"
+    "        x = fract(sin(x * 12.9898 + 78.233) * 43758.5453);\n"
+    "    c.rgb = mix(c.rgb, vec3(x), 0.25);\n"
+    "#if STRESS_TEXTURE\n"
+    "    c.rgb *= texture2D(tex, v_texcoord).rgb;\n"
+    "#endif\n"
+    "    gl_FragColor = c;\n"
+    "}\n";
+
+/* baked: position, texcoord, color; instanced: corner, rect, color */
+
+enum {
+    STRESS_ATTRIB_POSITION,
+    STRESS_ATTRIB_TEXCOORD,
+    STRESS_ATTRIB_COLOR,
+};
+
+#define STRESS_ATTRIB_CORNER    STRESS_ATTRIB_POSITION
+#define STRESS_ATTRIB_RECT      STRESS_ATTRIB_TEXCOORD
+
+#define STRESS_VERTEX_FLOATS    8
+#define STRESS_INSTANCE_FLOATS  8
+
+/* core in GLES 3 and GL 3.3, not declared by the GLES 2 headers */
+typedef void (*gl_draw_arrays_instanced_t)(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+typedef void (*gl_vertex_attrib_divisor_t)(GLuint index, GLuint divisor);
+
+static struct {
+    struct gl_stress_params params;
+    GLuint program;
+    GLuint vbo;
+    GLuint instance_vbo;
+    GLuint texture;
+    GLint phase;
+    GLsizei vertices;
+    GLsizei instances;          /* 0: baked geometry */
+    gl_draw_arrays_instanced_t draw_arrays_instanced;
+    gl_vertex_attrib_divisor_t vertex_attrib_divisor;
+    int width, height;
+} stress;
+
+/* "objects=N,layers=N,alu=N,texture=N", missing keys keep their values */
+
+bool gl_stress_parse(struct gl_stress_params *params, const char *spec)
+{
+    char * const keys[] = { "objects", "layers", "alu", "texture", NULL };
+    char *opts, *str, *value;
+    bool ok = true;
+    int key;
+
+    str = opts = strdup(spec);
+    if (!opts)
+        return false;
+
+    while (*opts && ok) {
+        key = getsubopt(&opts, keys, &value);
+        if (key < 0 || !value) {
+            fprintf(stderr, "bad stress parameter '%s', expected objects|layers|alu|texture=<n>\n", value ? value : spec);
+            ok = false;
+            break;
+        }
+
+        switch (key) {
+            case 0: params->objects = atoi(value); break;
+            case 1: params->layers = atoi(value); break;
+            case 2: params->alu = atoi(value); break;
+            case 3: params->texture = atoi(value); break;
+        }
+    }
+
+    free(str);
+
+    if (ok && (params->objects < 1 || params->layers < 1 || params->alu < 0 || params->texture < 0)) {
+        fprintf(stderr, "stress: objects and layers must be positive\n");
+        ok = false;
+    }
+
+    /* baked geometry has 6 vertices per object and layer, the count is a GLsizei */
+    if (ok && (long long) params->objects * params->layers * 6 > INT_MAX) {
+        fprintf(stderr, "stress: %d objects x %d layers is too much geometry\n", params->objects, params->layers);
+        ok = false;
+    }
+
+    return ok;
+}
+
+/* GLES 3.0 or GL 3.3: glDrawArraysInstanced and glVertexAttribDivisor are core */
 
+static bool stress_instancing(void)
+{
+    const char *version = (const char *) glGetString(GL_VERSION);
+    int major = 0, minor = 0;
+
+    if (!version)
+        return false;
+
+    if (gl_use_gles) {
+        if (sscanf(version, "OpenGL ES %d.%d", &major, &minor) != 2 || major < 3)
+            return false;
+    } else {
+        if (sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 33)
+            return false;
+    }
+
+    stress.draw_arrays_instanced = (gl_draw_arrays_instanced_t) eglGetProcAddress("glDrawArraysInstanced");
+    stress.vertex_attrib_divisor = (gl_vertex_attrib_divisor_t) eglGetProcAddress("glVertexAttribDivisor");
+
+    return stress.draw_arrays_instanced && stress.vertex_attrib_divisor;
+}
+
+/* smallest grid with at least 'objects' cells, cells cover the whole viewport */
+
+static void stress_grid(const struct gl_stress_params *params, int *cols, int *rows)
+{
+    *cols = (int) ceil(sqrt((double) params->objects));
+    *rows = (params->objects + *cols - 1) / *cols;
+}
+
+/* x, y, width, height of one object in clip space and its color */
+
+static void stress_object(int cols, int rows, int layer, int obj, GLfloat *rect, GLfloat *color)
+{
+    rect[0] = -1.0f + 2.0f * (obj % cols) / cols;
+    rect[1] = -1.0f + 2.0f * (obj / cols) / rows;
+    rect[2] = 2.0f / cols;
+    rect[3] = 2.0f / rows;
+
+    color[0] = (GLfloat) ((obj * 7 + layer) % 11) / 10.0f;
+    color[1] = (GLfloat) ((obj * 3 + layer * 5) % 13) / 12.0f;
+    color[2] = (GLfloat) ((obj + layer * 3) % 7) / 6.0f;
+
+    /* translucent: every layer has to be blended, nothing is rejected early */
+    color[3] = 1.0f / (layer + 1);
+}
+
+/* per instance rect and color, layer by layer so blending order is kept */
+
+static GLfloat * stress_instance_data(const struct gl_stress_params *params, GLsizei *count)
+{
+    GLfloat *data, *v;
+    int cols, rows, layer, obj;
+
+    stress_grid(params, &cols, &rows);
+    *count = params->objects * params->layers;
+
+    data = malloc((size_t) *count * STRESS_INSTANCE_FLOATS * sizeof(GLfloat));
+    if (!data)
+        return NULL;
+
+    v = data;
+
+    for (layer = 0; layer < params->layers; layer++) {
+        for (obj = 0; obj < params->objects; obj++, v += STRESS_INSTANCE_FLOATS)
+            stress_object(cols, rows, layer, obj, v, v + 4);
+    }
+
+    return data;
+}
+
+static GLfloat * stress_geometry(const struct gl_stress_params *params, GLsizei *count)
+{
+    GLfloat rect[4], color[4], x, y;
+    GLfloat *data, *v;
+    int cols, rows, layer, obj, i;
+
+    static const int corners[6][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 1 }, { 1, 0 }, { 1, 1 } };
+
+    stress_grid(params, &cols, &rows);
+    *count = params->objects * params->layers * 6;
+
+    data = malloc((size_t) *count * STRESS_VERTEX_FLOATS * sizeof(GLfloat));
+    if (!data)
+        return NULL;
+
+    v = data;
+
+    for (layer = 0; layer < params->layers; layer++) {
+        for (obj = 0; obj < params->objects; obj++) {
+            stress_object(cols, rows, layer, obj, rect, color);
+
+            for (i = 0; i < 6; i++) {
+                x = rect[0] + corners[i][0] * rect[2];
+                y = rect[1] + corners[i][1] * rect[3];
+
+                *v++ = x;
+                *v++ = y;
+                *v++ = (x + 1.0f) / 2.0f;
+                *v++ = (y + 1.0f) / 2.0f;
+                memcpy(v, color, sizeof(color));
+                v += 4;
+            }
+        }
+    }
+
+    return data;
+}
+
+static bool stress_setup_instanced(void)
+{
+    static const GLfloat corners[] = { 0, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 1 };
+    const GLsizei stride = STRESS_INSTANCE_FLOATS * sizeof(GLfloat);
+    GLfloat *instances;
+
+    instances = stress_instance_data(&stress.params, &stress.instances);
+    if (!instances)
+        return false;
+
+    glGenBuffers(1, &stress.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, stress.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(STRESS_ATTRIB_CORNER, 2, GL_FLOAT, GL_FALSE, 0, (void *) 0);
+
+    glGenBuffers(1, &stress.instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, stress.instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) stress.instances * stride, instances, GL_STATIC_DRAW);
+    free(instances);
+
+    glVertexAttribPointer(STRESS_ATTRIB_RECT, 4, GL_FLOAT, GL_FALSE, stride, (void *) 0);
+    glVertexAttribPointer(STRESS_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, stride, (void *) (4 * sizeof(GLfloat)));
+    stress.vertex_attrib_divisor(STRESS_ATTRIB_RECT, 1);
+    stress.vertex_attrib_divisor(STRESS_ATTRIB_COLOR, 1);
+
+    stress.vertices = 6;
+    return true;
+}
+
+static bool stress_setup_baked(void)
+{
+    const GLsizei stride = STRESS_VERTEX_FLOATS * sizeof(GLfloat);
+    GLfloat *geometry;
+
+    geometry = stress_geometry(&stress.params, &stress.vertices);
+    if (!geometry)
+        return false;
+
+    glGenBuffers(1, &stress.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, stress.vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) stress.vertices * stride, geometry, GL_STATIC_DRAW);
+    free(geometry);
+
+    glVertexAttribPointer(STRESS_ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, stride, (void *) 0);
+    glVertexAttribPointer(STRESS_ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, stride, (void *) (2 * sizeof(GLfloat)));
+    glVertexAttribPointer(STRESS_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, stride, (void *) (4 * sizeof(GLfloat)));
+
+    stress.instances = 0;
+    return true;
+}
+
+/* square RGBA texture stretched over the screen and sampled once per
+ * fragment: size sets the footprint, not the traffic, neighbouring
+ * fragments share texels and most fetches are served from cache
+ */
+
+static GLuint stress_texture(int size)
+{
+    uint32_t *texels;
+    GLuint texture;
+    int x, y;
+
+    texels = malloc((size_t) size * size * sizeof(uint32_t));
+    if (!texels)
+        return 0;
+
+    for (y = 0; y < size; y++) {
+        for (x = 0; x < size; x++)
+            texels[y * size + x] = ((x ^ y) & 8) ? 0xffffffff : 0xff808080;
+    }
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    free(texels);
+    return texture;
+}
+
+bool stress_init(const struct gl_stress_params *params)
+{
+    static const char * const attribs[] = { "position", "texcoord", "color" };
+    static const char * const instanced_attribs[] = { "corner", "rect", "color" };
+    char defines[64], *fs_src;
+    bool instanced, ok;
+
+    printf("%s renderer: %s, %s\n", gl_api_name(), glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    memset(&stress, 0, sizeof(stress));
+    stress.params = *params;
+
+    instanced = stress_instancing();
+
+    printf("stress: %d objects, %d layers, %d alu iterations, texture %d, %s\n",
+        params->objects, params->layers, params->alu, params->texture,
+        instanced ? "instanced" : "baked geometry");
+
+    snprintf(defines, sizeof(defines), "#define STRESS_ALU %d\n#define STRESS_TEXTURE %d\n",
+        params->alu, params->texture > 0);
+
+    fs_src = malloc(strlen(defines) + sizeof(stress_fragment_src));
+    if (!fs_src)
+        return false;
+
+    strcpy(fs_src, defines);
+    strcat(fs_src, stress_fragment_src);
+
+    if (instanced)
+        stress.program = gl_program_create(stress_instanced_vertex_src, fs_src, instanced_attribs, 3);
+    else
+        stress.program = gl_program_create(stress_vertex_src, fs_src, attribs, 3);
+    free(fs_src);
+
+    if (!stress.program)
+        return false;
+
+    ok = instanced ? stress_setup_instanced() : stress_setup_baked();
+    if (!ok) {
+        glDeleteProgram(stress.program);
+        return false;
+    }
+
+    glEnableVertexAttribArray(STRESS_ATTRIB_POSITION);
+    glEnableVertexAttribArray(STRESS_ATTRIB_TEXCOORD);
+    glEnableVertexAttribArray(STRESS_ATTRIB_COLOR);
+
+    if (params->texture > 0)
+        stress.texture = stress_texture(params->texture);
+
+    glUseProgram(stress.program);
+    glUniform1i(glGetUniformLocation(stress.program, "tex"), 0);
+    stress.phase = glGetUniformLocation(stress.program, "phase");
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    return true;
+}
+
+void stress_fini(void)
+{
+    glDisable(GL_BLEND);
+
+    /* divisors are vertex array state: the triangle renderer must not inherit them */
+    if (stress.instances) {
+        stress.vertex_attrib_divisor(STRESS_ATTRIB_RECT, 0);
+        stress.vertex_attrib_divisor(STRESS_ATTRIB_COLOR, 0);
+    }
+
+    glDisableVertexAttribArray(STRESS_ATTRIB_POSITION);
+    glDisableVertexAttribArray(STRESS_ATTRIB_TEXCOORD);
+    glDisableVertexAttribArray(STRESS_ATTRIB_COLOR);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+
+    glDeleteTextures(1, &stress.texture);
+    glDeleteBuffers(1, &stress.instance_vbo);
+    glDeleteBuffers(1, &stress.vbo);
+    glDeleteProgram(stress.program);
+
+    memset(&stress, 0, sizeof(stress));
+}
+
+/* queue one frame, like render_frame() */
+
+void stress_frame(int width, int height, GLfloat phase)
+{
+    if (width != stress.width || height != stress.height) {
+        glViewport(0, 0, (GLint) width, (GLint) height);
+        stress.width = width;
+        stress.height = height;
+    }
+
+    glUniform1f(stress.phase, phase / 360.0f);
+
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (stress.instances)
+        stress.draw_arrays_instanced(GL_TRIANGLES, 0, stress.vertices, stress.instances);
+    else
+        glDrawArrays(GL_TRIANGLES, 0, stress.vertices);
+}
+
+/* throughput of 'frames' stress frames of width x height rendered in 'seconds' */
+
+void stress_report(unsigned long frames, double seconds, int width, int height)
+{
+    const struct gl_stress_params *p = &stress.params;
+    double pixels, triangles;
+
+    if (!frames || seconds <= 0.0)
+        return;
+
+    triangles = (double) frames * p->objects * p->layers * 2;
+    pixels = (double) frames * width * height * p->layers;
+
+    printf("stress: %lu frames in %.2f s, %.1f fps\n", frames, seconds, frames / seconds);
+    printf("stress: %.2f Mtriangles/s, fill rate %.1f Mpixels/s (%d layers overdraw)\n",
+        triangles / seconds / 1e6, pixels / seconds / 1e6, p->layers);
+
+    /* one bilinear sample per fragment; a rate, not memory bandwidth */
+    if (p->texture > 0)
+        printf("stress: %.1f Mtexture samples/s from a %dx%d RGBA texture (%.1f MB)\n",
+            pixels / seconds / 1e6, p->texture, p->texture,
+            (double) p->texture * p->texture * 4 / 1e6);
+}
+
+/* scene of a frame loop: the stress scene or the triangle */
+
+static bool scene_stress;
+
+bool gl_scene_init(const struct gl_stress_params *params)
+{
+    scene_stress = params != NULL;
+
+    return scene_stress ? stress_init(params) : render_init();
+}
+
+void gl_scene_fini(void)
+{
+    if (scene_stress)
+        stress_fini();
+    else
+        render_fini();
+}
+
+void gl_scene_frame(int width, int height, GLfloat phase)
+{
+    if (scene_stress)
+        stress_frame(width, height, phase);
+    else
+        render_frame(width, height, phase);
+}
+
+void gl_scene_report(unsigned long frames, double seconds, int width, int height)
+{
+    if (scene_stress && frames)
+        stress_report(frames, seconds, width, height);
+}
@@ -5,14 +5,65 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <limits.h>
+#include <math.h>
 #include <error.h>
 #include <errno.h>
 
+#include <EGL/egl.h>
+
+/* WITH_GLES builds against GLES 2/3 headers and libGLESv2, desktop GL otherwise */
+
+#ifdef HAVE_GLES
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#else
 #define GL_GLEXT_PROTOTYPES
 
 #include <GL/gl.h>
 #include <GL/glext.h>
+#endif
 
 /* */
 
+/* client API, "gl" or "gles": defaults to what the build uses, switchable at run time */
+bool gl_set_api(const char *name);
+bool gl_api_gles(void);
+const char * gl_api_name(void);
+
+EGLint gl_renderable_type(void);
+EGLContext gl_context_create(EGLDisplay dpy, EGLConfig config);
+
+GLuint gl_program_create(const char *vs_src, const char *fs_src, const char * const *attribs, int count);
+void gl_mat4_multiply(GLfloat *out, const GLfloat *a, const GLfloat *b);
+void gl_mat4_mvp(GLfloat *mvp, int width, int height, GLfloat rotz);
+
+/* needs a current context: call after eglMakeCurrent, fini before releasing it */
+bool render_init(void);
+void render_fini(void);
+
+void render_frame(int width, int height, GLfloat rotz);
 void render_stuff(int width, int height, GLfloat rotz);
+
+/* GPU stress scene, used instead of the render_* triangle */
+
+struct gl_stress_params {
+    int objects;    /* quads per layer, tiling the viewport */
+    int layers;     /* overdraw: blended full screen passes */
+    int alu;        /* fragment shader loop iterations */
+    int texture;    /* texture size in texels, 0: no texturing */
+};
+
+#define GL_STRESS_DEFAULTS  { .objects = 1024, .layers = 4, .alu = 8, .texture = 1024 }
+
+bool gl_stress_parse(struct gl_stress_params *params, const char *spec);
+bool stress_init(const struct gl_stress_params *params);
+void stress_fini(void);
+void stress_frame(int width, int height, GLfloat phase);
+void stress_report(unsigned long frames, double seconds, int width, int height);
+
+/* frame loop scene: stress scene with params, the triangle with NULL; frames are queued, not waited for */
+bool gl_scene_init(const struct gl_stress_params *params);
+void gl_scene_fini(void);
+void gl_scene_frame(int width, int height, GLfloat phase);
+void gl_scene_report(unsigned long frames, double seconds, int width, int height);
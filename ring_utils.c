@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include "ring_utils.h"
+
+/* */
+
+struct drm_ring * drm_ring_create(int *memfd)
+{
+	struct drm_ring *ring;
+	int fd;
+
+	fd = memfd_create("drm_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		perror("failed memfd_create()");
+		return NULL;
+	}
+
+	if (ftruncate(fd, sizeof(struct drm_ring)) < 0) {
+		perror("failed ftruncate()");
+		goto err_close;
+	}
+
+	/* server maps this memory: never let it shrink under the mapping */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		perror("failed fcntl(F_ADD_SEALS)");
+		goto err_close;
+	}
+
+	ring = mmap(NULL, sizeof(struct drm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("failed mmap()");
+		goto err_close;
+	}
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+
+	*memfd = fd;
+	return ring;
+
+err_close:
+	close(fd);
+	return NULL;
+}
+
+struct drm_ring * drm_ring_map(int memfd)
+{
+	struct drm_ring *ring;
+	struct stat st;
+	int seals;
+
+	if (fstat(memfd, &st) < 0) {
+		perror("failed fstat()");
+		return NULL;
+	}
+
+	seals = fcntl(memfd, F_GET_SEALS);
+
+	if (st.st_size < sizeof(struct drm_ring) || seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		fprintf(stderr, "ring memory is too small or not sealed\n");
+		return NULL;
+	}
+
+	ring = mmap(NULL, sizeof(struct drm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (ring == MAP_FAILED) {
+		perror("failed mmap()");
+		return NULL;
+	}
+
+	return ring;
+}
+
+void drm_ring_unmap(struct drm_ring *ring)
+{
+	munmap(ring, sizeof(struct drm_ring));
+}
+
+bool drm_ring_push(struct drm_ring *ring, struct drm_ring_cmd *cmd)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail >= DRM_RING_SLOTS)
+		return false;
+
+	ring->cmds[head & (DRM_RING_SLOTS - 1)] = *cmd;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	return true;
+}
+
+bool drm_ring_pop(struct drm_ring *ring, struct drm_ring_cmd *cmd)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail)
+		return false;
+
+	/* producer lives in another process: do not trust its index */
+	if (head - tail > DRM_RING_SLOTS) {
+		fprintf(stderr, "ring is corrupted, drop %u entries\n", head - tail);
+		atomic_store_explicit(&ring->tail, head, memory_order_release);
+		return false;
+	}
+
+	*cmd = ring->cmds[tail & (DRM_RING_SLOTS - 1)];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	return true;
+}
+
+/* */
+
+int drm_send_msg(int sock, void *buf, size_t len, int *fds, int nfds)
+{
+	char control[CMSG_SPACE(sizeof(int) * DRM_RING_MAXFDS)];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+
+	if (nfds > DRM_RING_MAXFDS)
+		return -EINVAL;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (nfds > 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	return sendmsg(sock, &msg, 0);
+}
+
+int drm_recv_msg(int sock, void *buf, size_t len, int *fds, int *nfds)
+{
+	char control[CMSG_SPACE(sizeof(int) * DRM_RING_MAXFDS)];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int ret, n;
+
+	memset(&msg, 0, sizeof(msg));
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	*nfds = 0;
+
+	ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (ret <= 0)
+		return ret;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (n > DRM_RING_MAXFDS - *nfds)
+			n = DRM_RING_MAXFDS - *nfds;
+
+		memcpy(fds + *nfds, CMSG_DATA(cmsg), sizeof(int) * n);
+		*nfds += n;
+	}
+
+	return ret;
+}
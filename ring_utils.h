@@ -0,0 +1,59 @@
+#ifndef RING_UTILS_H
+#define RING_UTILS_H
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+
+/* */
+
+#define DRM_RING_SLOTS	256		/* must be a power of two */
+#define DRM_RING_MAXFDS	2
+
+/* single-producer/single-consumer command ring shared by client and server:
+ *   client writes cmds[] and publishes them by advancing head,
+ *   server consumes cmds[] and releases them by advancing tail;
+ * indices are free running, slot is index & (DRM_RING_SLOTS - 1)
+ */
+
+struct drm_ring_cmd {
+	uint32_t crtc_id;
+	uint32_t plane_id;
+	uint32_t fb;
+	uint32_t w;
+	uint32_t h;
+	uint32_t x;
+	uint32_t y;
+};
+
+struct drm_ring {
+	_Atomic uint32_t head;
+	char pad0[60];
+	_Atomic uint32_t tail;
+	char pad1[60];
+	struct drm_ring_cmd cmds[DRM_RING_SLOTS];
+};
+
+/* */
+
+struct drm_ring * drm_ring_create(int *memfd);
+struct drm_ring * drm_ring_map(int memfd);
+void drm_ring_unmap(struct drm_ring *ring);
+bool drm_ring_push(struct drm_ring *ring, struct drm_ring_cmd *cmd);
+bool drm_ring_pop(struct drm_ring *ring, struct drm_ring_cmd *cmd);
+
+int drm_send_msg(int sock, void *buf, size_t len, int *fds, int nfds);
+int drm_recv_msg(int sock, void *buf, size_t len, int *fds, int *nfds);
+
+#endif /* RING_UTILS_H */
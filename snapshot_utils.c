@@ -0,0 +1,571 @@
+#include "drm_utils.h"
+#include "snapshot_utils.h"
+
+/* */
+
+static const size_t snap_elem_size[DRM_SNAP_NSECTIONS] = {
+	[DRM_SNAP_CRTCS] = sizeof(struct drm_snap_crtc),
+	[DRM_SNAP_CONNECTORS] = sizeof(struct drm_snap_connector),
+	[DRM_SNAP_ENCODERS] = sizeof(struct drm_snap_encoder),
+	[DRM_SNAP_PLANES] = sizeof(struct drm_snap_plane),
+	[DRM_SNAP_FBS] = sizeof(struct drm_snap_fb),
+	[DRM_SNAP_MODES] = sizeof(drmModeModeInfo),
+	[DRM_SNAP_PROPS] = sizeof(struct drm_snap_prop),
+	[DRM_SNAP_IDS] = sizeof(uint32_t),
+};
+
+#define SNAP_ALIGN(x)	(((x) + 7) & ~(size_t) 7)
+
+/* sections grow independently while the snapshot is taken, then get packed */
+
+struct snap_vec {
+	char *data;
+	uint32_t count;
+	uint32_t size;
+};
+
+struct snap_builder {
+	struct snap_vec vecs[DRM_SNAP_NSECTIONS];
+	bool failed;
+};
+
+/* n zeroed records at the end of a section, index of the first one */
+
+static uint32_t snap_add(struct snap_builder *b, int section, uint32_t n)
+{
+	struct snap_vec *v = &b->vecs[section];
+	size_t elem = snap_elem_size[section];
+	uint32_t first = v->count;
+	uint32_t size;
+	char *data;
+
+	if (!n)
+		return first;
+
+	if (v->count + n > v->size) {
+		size = v->size ? v->size * 2 : 16;
+		while (size < v->count + n)
+			size *= 2;
+
+		data = realloc(v->data, size * elem);
+		if (!data) {
+			b->failed = true;
+			return 0;
+		}
+
+		v->data = data;
+		v->size = size;
+	}
+
+	memset(v->data + first * elem, 0, n * elem);
+	v->count += n;
+
+	return first;
+}
+
+#define snap_at(b, section, type, i)	((type *) (b)->vecs[section].data + (i))
+
+static void snap_add_ids(struct snap_builder *b, struct drm_snap_list *list, uint32_t *ids, uint32_t count)
+{
+	uint32_t first;
+
+	first = snap_add(b, DRM_SNAP_IDS, count);
+	if (b->failed || !count)
+		return;
+
+	memcpy(snap_at(b, DRM_SNAP_IDS, uint32_t, first), ids, count * sizeof(uint32_t));
+
+	list->first = first;
+	list->count = count;
+}
+
+static void snap_add_props(struct snap_builder *b, int fd, uint32_t obj_id, uint32_t obj_type,
+		struct drm_snap_list *list)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	struct drm_snap_prop *sp;
+	uint32_t first, i;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props)
+		return;
+
+	first = snap_add(b, DRM_SNAP_PROPS, props->count_props);
+	if (b->failed)
+		goto out;
+
+	for (i = 0; i < props->count_props; i++) {
+		sp = snap_at(b, DRM_SNAP_PROPS, struct drm_snap_prop, first + i);
+		sp->prop_id = props->props[i];
+		sp->value = props->prop_values[i];
+
+		prop = drm_prop_get(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		sp->flags = prop->flags;
+		memcpy(sp->name, prop->name, sizeof(sp->name));
+		sp->name[sizeof(sp->name) - 1] = '\0';
+	}
+
+	list->first = first;
+	list->count = props->count_props;
+
+out:
+	drmModeFreeObjectProperties(props);
+}
+
+static void snap_add_fb(struct snap_builder *b, int fd, uint32_t fb_id)
+{
+	struct drm_snap_fb *sfb;
+	drmModeFB2 *fb2;
+	drmModeFB *fb;
+	uint32_t i;
+
+	if (!fb_id)
+		return;
+
+	for (i = 0; i < b->vecs[DRM_SNAP_FBS].count; i++) {
+		if (snap_at(b, DRM_SNAP_FBS, struct drm_snap_fb, i)->fb_id == fb_id)
+			return;
+	}
+
+	fb2 = drmModeGetFB2(fd, fb_id);
+	fb = fb2 ? NULL : drmModeGetFB(fd, fb_id);
+
+	if (!fb2 && !fb)
+		return;
+
+	i = snap_add(b, DRM_SNAP_FBS, 1);
+	if (b->failed)
+		goto out;
+
+	sfb = snap_at(b, DRM_SNAP_FBS, struct drm_snap_fb, i);
+	sfb->fb_id = fb_id;
+
+	if (fb2) {
+		sfb->width = fb2->width;
+		sfb->height = fb2->height;
+		sfb->pixel_format = fb2->pixel_format;
+		sfb->modifier = fb2->modifier;
+		memcpy(sfb->pitches, fb2->pitches, sizeof(sfb->pitches));
+		memcpy(sfb->offsets, fb2->offsets, sizeof(sfb->offsets));
+	} else {
+		sfb->width = fb->width;
+		sfb->height = fb->height;
+		sfb->bpp = fb->bpp;
+		sfb->depth = fb->depth;
+		sfb->pitches[0] = fb->pitch;
+	}
+
+out:
+	if (fb2)
+		drmModeFreeFB2(fb2);
+	if (fb)
+		drmModeFreeFB(fb);
+}
+
+/* point views at the sections of an image */
+
+static void snap_bind(struct drm_snapshot *snap, void *image)
+{
+	struct drm_snap_section *s;
+	char *base = image;
+
+	snap->header = image;
+	s = snap->header->sections;
+
+	snap->crtcs = (void *) (base + s[DRM_SNAP_CRTCS].offset);
+	snap->connectors = (void *) (base + s[DRM_SNAP_CONNECTORS].offset);
+	snap->encoders = (void *) (base + s[DRM_SNAP_ENCODERS].offset);
+	snap->planes = (void *) (base + s[DRM_SNAP_PLANES].offset);
+	snap->fbs = (void *) (base + s[DRM_SNAP_FBS].offset);
+	snap->modes = (void *) (base + s[DRM_SNAP_MODES].offset);
+	snap->props = (void *) (base + s[DRM_SNAP_PROPS].offset);
+	snap->ids = (void *) (base + s[DRM_SNAP_IDS].offset);
+}
+
+static struct drm_snapshot * snap_pack(struct snap_builder *b, drmModeRes *res, bool probe)
+{
+	struct drm_snapshot_header *header;
+	struct drm_snapshot *snap;
+	size_t size, len;
+	char *image;
+	int i;
+
+	size = SNAP_ALIGN(sizeof(*header));
+	for (i = 0; i < DRM_SNAP_NSECTIONS; i++)
+		size += SNAP_ALIGN(b->vecs[i].count * snap_elem_size[i]);
+
+	if (size > UINT32_MAX)
+		return NULL;
+
+	snap = calloc(1, sizeof(*snap));
+	image = calloc(1, size);
+	if (!snap || !image) {
+		free(snap);
+		free(image);
+		return NULL;
+	}
+
+	header = (struct drm_snapshot_header *) image;
+	header->magic = DRM_SNAPSHOT_MAGIC;
+	header->version = DRM_SNAPSHOT_VERSION;
+	header->size = size;
+	header->probe = probe;
+	header->min_width = res->min_width;
+	header->max_width = res->max_width;
+	header->min_height = res->min_height;
+	header->max_height = res->max_height;
+
+	size = SNAP_ALIGN(sizeof(*header));
+	for (i = 0; i < DRM_SNAP_NSECTIONS; i++) {
+		len = b->vecs[i].count * snap_elem_size[i];
+
+		header->sections[i].offset = size;
+		header->sections[i].count = b->vecs[i].count;
+
+		if (len)
+			memcpy(image + size, b->vecs[i].data, len);
+
+		size += SNAP_ALIGN(len);
+	}
+
+	snap->size = size;
+	snap_bind(snap, image);
+	return snap;
+}
+
+/* */
+
+struct drm_snapshot * drm_snapshot_take(int fd, bool probe)
+{
+	struct snap_builder b;
+	struct drm_snapshot *snap = NULL;
+
+	struct drm_snap_connector *sconn;
+	struct drm_snap_encoder *senc;
+	struct drm_snap_plane *splane;
+	struct drm_snap_crtc *scrtc;
+
+	drmModeConnector *connector;
+	drmModePlaneRes *plane_res;
+	drmModeEncoder *encoder;
+	drmModePlane *plane;
+	drmModeCrtc *crtc;
+	drmModeRes *res;
+
+	uint32_t first, n;
+	int i;
+
+	memset(&b, 0, sizeof(b));
+
+	/* primary and cursor planes are a part of the topology too */
+	drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+	res = drmModeGetResources(fd);
+	if (!res) {
+		fprintf(stderr, "drmModeGetResources failed\n");
+		return NULL;
+	}
+
+	for (i = 0; i < res->count_crtcs && !b.failed; i++) {
+		crtc = drmModeGetCrtc(fd, res->crtcs[i]);
+		if (!crtc)
+			continue;
+
+		n = snap_add(&b, DRM_SNAP_CRTCS, 1);
+		if (!b.failed) {
+			scrtc = snap_at(&b, DRM_SNAP_CRTCS, struct drm_snap_crtc, n);
+			scrtc->crtc_id = crtc->crtc_id;
+			scrtc->buffer_id = crtc->buffer_id;
+			scrtc->x = crtc->x;
+			scrtc->y = crtc->y;
+			scrtc->width = crtc->width;
+			scrtc->height = crtc->height;
+			scrtc->mode_valid = crtc->mode_valid;
+			scrtc->gamma_size = crtc->gamma_size;
+			scrtc->mode = crtc->mode;
+
+			snap_add_props(&b, fd, crtc->crtc_id, DRM_MODE_OBJECT_CRTC, &scrtc->props);
+		}
+
+		drmModeFreeCrtc(crtc);
+	}
+
+	for (i = 0; i < res->count_connectors && !b.failed; i++) {
+		if (probe)
+			connector = drmModeGetConnector(fd, res->connectors[i]);
+		else
+			connector = drmModeGetConnectorCurrent(fd, res->connectors[i]);
+
+		if (!connector)
+			continue;
+
+		n = snap_add(&b, DRM_SNAP_CONNECTORS, 1);
+		if (!b.failed) {
+			sconn = snap_at(&b, DRM_SNAP_CONNECTORS, struct drm_snap_connector, n);
+			sconn->connector_id = connector->connector_id;
+			sconn->encoder_id = connector->encoder_id;
+			sconn->connector_type = connector->connector_type;
+			sconn->connector_type_id = connector->connector_type_id;
+			sconn->connection = connector->connection;
+			sconn->mm_width = connector->mmWidth;
+			sconn->mm_height = connector->mmHeight;
+			sconn->subpixel = connector->subpixel;
+
+			first = snap_add(&b, DRM_SNAP_MODES, connector->count_modes);
+			if (!b.failed && connector->count_modes) {
+				memcpy(snap_at(&b, DRM_SNAP_MODES, drmModeModeInfo, first), connector->modes,
+					connector->count_modes * sizeof(drmModeModeInfo));
+				sconn->modes.first = first;
+				sconn->modes.count = connector->count_modes;
+			}
+
+			snap_add_ids(&b, &sconn->encoders, connector->encoders, connector->count_encoders);
+			snap_add_props(&b, fd, connector->connector_id, DRM_MODE_OBJECT_CONNECTOR, &sconn->props);
+		}
+
+		drmModeFreeConnector(connector);
+	}
+
+	for (i = 0; i < res->count_encoders && !b.failed; i++) {
+		encoder = drmModeGetEncoder(fd, res->encoders[i]);
+		if (!encoder)
+			continue;
+
+		n = snap_add(&b, DRM_SNAP_ENCODERS, 1);
+		if (!b.failed) {
+			senc = snap_at(&b, DRM_SNAP_ENCODERS, struct drm_snap_encoder, n);
+			senc->encoder_id = encoder->encoder_id;
+			senc->encoder_type = encoder->encoder_type;
+			senc->crtc_id = encoder->crtc_id;
+			senc->possible_crtcs = encoder->possible_crtcs;
+			senc->possible_clones = encoder->possible_clones;
+		}
+
+		drmModeFreeEncoder(encoder);
+	}
+
+	plane_res = drmModeGetPlaneResources(fd);
+
+	for (i = 0; plane_res && i < plane_res->count_planes && !b.failed; i++) {
+		plane = drmModeGetPlane(fd, plane_res->planes[i]);
+		if (!plane)
+			continue;
+
+		n = snap_add(&b, DRM_SNAP_PLANES, 1);
+		if (!b.failed) {
+			splane = snap_at(&b, DRM_SNAP_PLANES, struct drm_snap_plane, n);
+			splane->plane_id = plane->plane_id;
+			splane->crtc_id = plane->crtc_id;
+			splane->fb_id = plane->fb_id;
+			splane->crtc_x = plane->crtc_x;
+			splane->crtc_y = plane->crtc_y;
+			splane->x = plane->x;
+			splane->y = plane->y;
+			splane->possible_crtcs = plane->possible_crtcs;
+			splane->gamma_size = plane->gamma_size;
+
+			snap_add_ids(&b, &splane->formats, plane->formats, plane->count_formats);
+			snap_add_props(&b, fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, &splane->props);
+		}
+
+		drmModeFreePlane(plane);
+	}
+
+	if (plane_res)
+		drmModeFreePlaneResources(plane_res);
+
+	/* framebuffers on screen and the ones this client owns */
+
+	for (n = 0; n < b.vecs[DRM_SNAP_CRTCS].count && !b.failed; n++)
+		snap_add_fb(&b, fd, snap_at(&b, DRM_SNAP_CRTCS, struct drm_snap_crtc, n)->buffer_id);
+
+	for (n = 0; n < b.vecs[DRM_SNAP_PLANES].count && !b.failed; n++)
+		snap_add_fb(&b, fd, snap_at(&b, DRM_SNAP_PLANES, struct drm_snap_plane, n)->fb_id);
+
+	for (i = 0; i < res->count_fbs && !b.failed; i++)
+		snap_add_fb(&b, fd, res->fbs[i]);
+
+	if (b.failed)
+		fprintf(stderr, "out of memory while taking snapshot\n");
+	else
+		snap = snap_pack(&b, res, probe);
+
+	for (i = 0; i < DRM_SNAP_NSECTIONS; i++)
+		free(b.vecs[i].data);
+
+	drmModeFreeResources(res);
+	return snap;
+}
+
+/* */
+
+static bool snap_list_valid(struct drm_snapshot *snap, struct drm_snap_list *list, int pool)
+{
+	uint32_t count = drm_snapshot_count(snap, pool);
+
+	return list->first <= count && list->count <= count - list->first;
+}
+
+static bool snap_name_valid(const char *name, size_t len)
+{
+	return memchr(name, '\0', len) != NULL;
+}
+
+static bool snap_valid(struct drm_snapshot *snap, size_t size)
+{
+	struct drm_snapshot_header *header = snap->header;
+	uint32_t i;
+
+	if (size < sizeof(*header) || header->magic != DRM_SNAPSHOT_MAGIC ||
+			header->version != DRM_SNAPSHOT_VERSION || header->size > size)
+		return false;
+
+	for (i = 0; i < DRM_SNAP_NSECTIONS; i++) {
+		if (header->sections[i].offset % 8 || header->sections[i].offset > header->size ||
+				header->sections[i].count > (header->size - header->sections[i].offset) / snap_elem_size[i])
+			return false;
+	}
+
+	/* lists and names are checked once here, users index pools and print names without checks */
+
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_CRTCS); i++) {
+		if (!snap_list_valid(snap, &snap->crtcs[i].props, DRM_SNAP_PROPS) ||
+				!snap_name_valid(snap->crtcs[i].mode.name, sizeof(snap->crtcs[i].mode.name)))
+			return false;
+	}
+
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_MODES); i++) {
+		if (!snap_name_valid(snap->modes[i].name, sizeof(snap->modes[i].name)))
+			return false;
+	}
+
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_PROPS); i++) {
+		if (!snap_name_valid(snap->props[i].name, sizeof(snap->props[i].name)))
+			return false;
+	}
+
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_CONNECTORS); i++) {
+		if (!snap_list_valid(snap, &snap->connectors[i].modes, DRM_SNAP_MODES) ||
+				!snap_list_valid(snap, &snap->connectors[i].encoders, DRM_SNAP_IDS) ||
+				!snap_list_valid(snap, &snap->connectors[i].props, DRM_SNAP_PROPS))
+			return false;
+	}
+
+	for (i = 0; i < drm_snapshot_count(snap, DRM_SNAP_PLANES); i++) {
+		if (!snap_list_valid(snap, &snap->planes[i].formats, DRM_SNAP_IDS) ||
+				!snap_list_valid(snap, &snap->planes[i].props, DRM_SNAP_PROPS))
+			return false;
+	}
+
+	return true;
+}
+
+struct drm_snapshot * drm_snapshot_load(const char *path)
+{
+	struct drm_snapshot *snap;
+	struct stat st;
+	void *image;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("cannot open snapshot");
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(struct drm_snapshot_header)) {
+		fprintf(stderr, "%s: not a snapshot\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (image == MAP_FAILED) {
+		perror("cannot map snapshot");
+		return NULL;
+	}
+
+	snap = calloc(1, sizeof(*snap));
+	if (!snap) {
+		munmap(image, st.st_size);
+		return NULL;
+	}
+
+	snap->mapped = true;
+	snap->size = st.st_size;
+	snap_bind(snap, image);
+
+	if (!snap_valid(snap, st.st_size)) {
+		fprintf(stderr, "%s: bad or incompatible snapshot\n", path);
+		munmap(image, st.st_size);
+		free(snap);
+		return NULL;
+	}
+
+	return snap;
+}
+
+int drm_snapshot_save(struct drm_snapshot *snap, const char *path)
+{
+	const char *data = (const char *) snap->header;
+	size_t left = snap->header->size;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror("cannot create snapshot");
+		return -1;
+	}
+
+	while (left) {
+		ret = write(fd, data, left);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("cannot write snapshot");
+			close(fd);
+			return -1;
+		}
+
+		data += ret;
+		left -= ret;
+	}
+
+	return close(fd);
+}
+
+/* object records (crtcs, connectors, encoders, planes, fbs) start with their id */
+
+void * drm_snapshot_find(struct drm_snapshot *snap, int section, uint32_t id)
+{
+	char *records = (char *) snap->header + snap->header->sections[section].offset;
+	uint32_t i;
+
+	for (i = 0; i < snap->header->sections[section].count; i++) {
+		if (*(uint32_t *) (records + i * snap_elem_size[section]) == id)
+			return records + i * snap_elem_size[section];
+	}
+
+	return NULL;
+}
+
+void drm_snapshot_free(struct drm_snapshot *snap)
+{
+	if (!snap)
+		return;
+
+	if (snap->mapped)
+		munmap(snap->header, snap->size);
+	else
+		free(snap->header);
+
+	free(snap);
+}
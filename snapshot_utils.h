@@ -0,0 +1,147 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+/* */
+
+#define DRM_SNAPSHOT_MAGIC		0x534d5244	/* "DRMS" */
+#define DRM_SNAPSHOT_VERSION	1
+
+/* KMS topology snapshot: one contiguous image made of a header followed by
+ * arrays of fixed size records; variable length lists (modes, encoders,
+ * formats, properties) are slices of shared pools. The in-memory image is
+ * written to disk as is, so a saved snapshot is used straight from mmap.
+ * Byte order is native, the magic tells a foreign one.
+ */
+
+enum {
+	DRM_SNAP_CRTCS,
+	DRM_SNAP_CONNECTORS,
+	DRM_SNAP_ENCODERS,
+	DRM_SNAP_PLANES,
+	DRM_SNAP_FBS,
+	DRM_SNAP_MODES,		/* pool of drmModeModeInfo */
+	DRM_SNAP_PROPS,		/* pool of struct drm_snap_prop */
+	DRM_SNAP_IDS,		/* pool of uint32_t: encoder ids, formats */
+	DRM_SNAP_NSECTIONS,
+};
+
+struct drm_snap_section {
+	uint32_t offset;	/* from the start of the image, 8 byte aligned */
+	uint32_t count;
+};
+
+struct drm_snap_list {
+	uint32_t first;		/* index into a pool */
+	uint32_t count;
+};
+
+struct drm_snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* whole image */
+	uint32_t probe;		/* connectors were probed, not current state */
+	uint32_t min_width, max_width;
+	uint32_t min_height, max_height;
+	struct drm_snap_section sections[DRM_SNAP_NSECTIONS];
+};
+
+struct drm_snap_prop {
+	uint32_t prop_id;
+	uint32_t flags;
+	char name[DRM_PROP_NAME_LEN];
+	uint64_t value;
+};
+
+struct drm_snap_crtc {
+	uint32_t crtc_id;
+	uint32_t buffer_id;
+	uint32_t x, y;
+	uint32_t width, height;
+	uint32_t mode_valid;
+	uint32_t gamma_size;
+	drmModeModeInfo mode;
+	struct drm_snap_list props;
+};
+
+struct drm_snap_connector {
+	uint32_t connector_id;
+	uint32_t encoder_id;
+	uint32_t connector_type;
+	uint32_t connector_type_id;
+	uint32_t connection;
+	uint32_t mm_width, mm_height;
+	uint32_t subpixel;
+	struct drm_snap_list modes;
+	struct drm_snap_list encoders;
+	struct drm_snap_list props;
+};
+
+struct drm_snap_encoder {
+	uint32_t encoder_id;
+	uint32_t encoder_type;
+	uint32_t crtc_id;
+	uint32_t possible_crtcs;
+	uint32_t possible_clones;
+};
+
+struct drm_snap_plane {
+	uint32_t plane_id;
+	uint32_t crtc_id;
+	uint32_t fb_id;
+	uint32_t crtc_x, crtc_y;
+	uint32_t x, y;
+	uint32_t possible_crtcs;
+	uint32_t gamma_size;
+	struct drm_snap_list formats;
+	struct drm_snap_list props;
+};
+
+struct drm_snap_fb {
+	uint32_t fb_id;
+	uint32_t width, height;
+	uint32_t pixel_format;	/* 0 if only legacy GETFB worked */
+	uint32_t bpp, depth;	/* legacy GETFB only */
+	uint64_t modifier;
+	uint32_t pitches[4];
+	uint32_t offsets[4];
+};
+
+/* view of an image, built in memory or mapped from a file */
+
+struct drm_snapshot {
+	struct drm_snapshot_header *header;
+
+	struct drm_snap_crtc *crtcs;
+	struct drm_snap_connector *connectors;
+	struct drm_snap_encoder *encoders;
+	struct drm_snap_plane *planes;
+	struct drm_snap_fb *fbs;
+	drmModeModeInfo *modes;
+	struct drm_snap_prop *props;
+	uint32_t *ids;
+
+	size_t size;
+	bool mapped;
+};
+
+#define drm_snapshot_count(snap, section)	((snap)->header->sections[section].count)
+
+/* */
+
+struct drm_snapshot * drm_snapshot_take(int fd, bool probe);
+struct drm_snapshot * drm_snapshot_load(const char *path);
+int drm_snapshot_save(struct drm_snapshot *snap, const char *path);
+void * drm_snapshot_find(struct drm_snapshot *snap, int section, uint32_t id);
+void drm_snapshot_free(struct drm_snapshot *snap);